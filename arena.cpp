@@ -0,0 +1,47 @@
+#include "arena.h"
+#include <cstdint>
+
+/*
+ * Arena constructor
+ */
+Arena::Arena()
+    : block_upto(0), ptr(nullptr), limit(nullptr), bytes_allocated(0) {}
+/*
+ * Arena destructor
+ */
+Arena::~Arena() = default;
+
+void *Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+  bytes_allocated += bytes;
+  if (bytes > BlockSize / 4) {
+    // alignment of operator new[] is enough for any standard type
+    large_blocks.emplace_back(new std::byte[bytes]);
+    return large_blocks.back().get();
+  }
+  for (;;) {
+    auto address = reinterpret_cast<std::uintptr_t>(ptr);
+    auto aligned = (address + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+    std::byte *start = reinterpret_cast<std::byte *>(aligned);
+    if (ptr && start + bytes <= limit) {
+      ptr = start + bytes;
+      return start;
+    }
+    // move on to the next block, reusing one from before the last reset
+    if (ptr) {
+      ++block_upto;
+    }
+    if (block_upto == blocks.size()) {
+      blocks.emplace_back(new std::byte[BlockSize]);
+    }
+    ptr = blocks[block_upto].get();
+    limit = ptr + BlockSize;
+  }
+}
+
+void Arena::reset() {
+  large_blocks.clear();
+  block_upto = 0;
+  ptr = blocks.empty() ? nullptr : blocks[0].get();
+  limit = blocks.empty() ? nullptr : ptr + BlockSize;
+  bytes_allocated = 0;
+}
@@ -0,0 +1,46 @@
+// arena allocation for per-document indexing state
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+/*
+ * Arena is a memory resource for data that dies together, such as the
+ * tokens, links and fields of one document. Allocation bumps a pointer in
+ * the current block; deallocation does nothing. reset() frees everything at
+ * once by rewinding to the first block, so the blocks are reused by the next
+ * document and a long run reaches a steady state without calling malloc.
+ * Requests larger than a quarter block get a block of their own, which
+ * reset() releases.
+ * Containers use it through std::pmr, e.g. std::pmr::vector<T> v(&arena).
+ * Not thread safe: one arena is used by one thread at a time.
+ */
+class Arena : public std::pmr::memory_resource {
+  static constexpr std::size_t BlockSize = 64 * 1024;
+  std::vector<std::unique_ptr<std::byte[]>> blocks;
+  std::vector<std::unique_ptr<std::byte[]>> large_blocks;
+  std::size_t block_upto; // block being filled
+  std::byte *ptr;         // next free byte in it
+  std::byte *limit;       // end of it
+  std::size_t bytes_allocated; // since the last reset
+
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void *, std::size_t, std::size_t) override {}
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+public:
+  Arena();
+  ~Arena() override;
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  void reset();
+  // bytes handed out since the last reset
+  std::size_t get_bytes_allocated() const { return bytes_allocated; }
+  // bytes held by the arena, reused across resets
+  std::size_t get_capacity() const { return blocks.size() * BlockSize; }
+};
@@ -0,0 +1,562 @@
+#include "async_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// AsyncIO
+
+AsyncIO::~AsyncIO() = default;
+
+void AsyncIO::wait(IORequest *request) {
+  std::unique_lock<std::mutex> lock(completion_lock);
+  completed.wait(lock, [&] { return request->done; });
+}
+
+std::unique_ptr<AsyncIO> AsyncIO::create(std::size_t threads) {
+  try {
+    return std::make_unique<UringIO>();
+  } catch (const std::runtime_error &) {
+    return std::make_unique<ThreadPoolIO>(threads);
+  }
+}
+
+// UringIO
+
+/*
+ * UringIO constructor
+ */
+UringIO::UringIO()
+    : ring_fd(-1), sq_ring(MAP_FAILED), sqes(MAP_FAILED), cq_ring(MAP_FAILED),
+      in_flight(0) {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd = (int)syscall(__NR_io_uring_setup, Entries, &params);
+  if (ring_fd < 0) {
+    throw std::runtime_error("io_uring is not available");
+  }
+  if (!supports_operations()) {
+    release();
+    throw std::runtime_error("io_uring lacks read and write operations");
+  }
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  }
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring != MAP_FAILED) {
+    cq_ring = single_mmap ? sq_ring
+                          : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring_fd,
+                                 IORING_OFF_CQ_RING);
+  }
+  if (cq_ring != MAP_FAILED) {
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  }
+  if (sqes == MAP_FAILED) {
+    release();
+    throw std::runtime_error("io_uring is not available");
+  }
+  char *sq = static_cast<char *>(sq_ring);
+  char *cq = static_cast<char *>(cq_ring);
+  sq_head = (unsigned *)(sq + params.sq_off.head);
+  sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  sq_array = (unsigned *)(sq + params.sq_off.array);
+  cq_head = (unsigned *)(cq + params.cq_off.head);
+  cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  cqes = cq + params.cq_off.cqes;
+  completion_thread = std::thread([this] {
+    do {
+      enter(0, 1, IORING_ENTER_GETEVENTS);
+    } while (reap());
+  });
+}
+/*
+ * UringIO destructor, once the requests submitted are done
+ */
+UringIO::~UringIO() {
+  {
+    std::lock_guard<std::mutex> guard(submit_lock);
+    {
+      // completions come in any order: the no-op that stops the completion
+      // thread must not overtake a request still in flight
+      std::unique_lock<std::mutex> lock(completion_lock);
+      room.wait(lock, [&] { return in_flight == 0; });
+      ++in_flight;
+    }
+    push(nullptr);
+    enter(1, 0, 0);
+  }
+  completion_thread.join();
+  release();
+}
+
+bool UringIO::supports_operations() {
+  // IORING_OP_READ and IORING_OP_WRITE came in Linux 5.6, with the probe;
+  // an older ring would fail every request with -EINVAL
+  std::size_t size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+  std::unique_ptr<char[]> buffer(new char[size]());
+  auto *probe = reinterpret_cast<io_uring_probe *>(buffer.get());
+  if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe,
+              256) < 0) {
+    return false;
+  }
+  for (int op : {IORING_OP_NOP, IORING_OP_READ, IORING_OP_WRITE,
+                 IORING_OP_FSYNC}) {
+    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void UringIO::release() {
+  if (sqes != MAP_FAILED) {
+    munmap(sqes, sqes_size);
+  }
+  if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+    munmap(cq_ring, cq_ring_size);
+  }
+  if (sq_ring != MAP_FAILED) {
+    munmap(sq_ring, sq_ring_size);
+  }
+  if (ring_fd >= 0) {
+    close(ring_fd);
+  }
+}
+
+void UringIO::push(IORequest *request) {
+  // only submitters, serialized by submit_lock, move the tail
+  unsigned tail = *sq_tail;
+  unsigned index = tail & sq_mask;
+  io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  if (!request) {
+    sqe->opcode = IORING_OP_NOP;
+  } else {
+    sqe->opcode = request->type == IORequest::Read    ? IORING_OP_READ
+                  : request->type == IORequest::Write ? IORING_OP_WRITE
+                                                      : IORING_OP_FSYNC;
+    sqe->fd = request->fd;
+    sqe->addr = (uint64_t)(uintptr_t)request->data;
+    sqe->len = (uint32_t)request->length;
+    sqe->off = request->offset;
+  }
+  sqe->user_data = (uint64_t)(uintptr_t)request;
+  sq_array[index] = index;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+unsigned UringIO::enter(unsigned to_submit, unsigned min_complete,
+                        unsigned flags) {
+  for (;;) {
+    long result = syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                          min_complete, flags, nullptr, 0);
+    if (result >= 0) {
+      return (unsigned)result;
+    }
+    if (errno != EINTR && errno != EAGAIN) {
+      throw std::runtime_error("io_uring_enter failed: " +
+                               std::string(std::strerror(errno)));
+    }
+  }
+}
+
+bool UringIO::reap() {
+  bool running = true;
+  std::size_t reaped = 0;
+  {
+    std::lock_guard<std::mutex> guard(completion_lock);
+    // only the completion thread moves the head
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head, ++reaped) {
+      const io_uring_cqe &cqe =
+          static_cast<const io_uring_cqe *>(cqes)[head & cq_mask];
+      auto *request = (IORequest *)(uintptr_t)cqe.user_data;
+      if (!request) {
+        running = false;
+        continue;
+      }
+      request->result = cqe.res;
+      request->done = true;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    in_flight -= reaped;
+  }
+  if (reaped > 0) {
+    completed.notify_all();
+    room.notify_all();
+  }
+  return running;
+}
+
+void UringIO::submit(IORequest *const *requests, std::size_t count) {
+  std::lock_guard<std::mutex> guard(submit_lock);
+  while (count > 0) {
+    std::size_t batch;
+    {
+      std::unique_lock<std::mutex> lock(completion_lock);
+      room.wait(lock, [&] { return in_flight < Entries; });
+      batch = std::min<std::size_t>(count, Entries - in_flight);
+      in_flight += batch;
+    }
+    // the kernel consumes every entry of a batch when entered, so the
+    // submission queue is empty between batches
+    for (std::size_t i = 0; i < batch; ++i) {
+      requests[i]->done = false;
+      push(requests[i]);
+    }
+    for (unsigned left = (unsigned)batch; left > 0;) {
+      left -= enter(left, 0, 0);
+    }
+    requests += batch;
+    count -= batch;
+  }
+}
+
+// ThreadPoolIO
+
+/*
+ * ThreadPoolIO constructor
+ */
+ThreadPoolIO::ThreadPoolIO(std::size_t threads) : closing(false) {
+  for (std::size_t i = 0; i < std::max<std::size_t>(threads, 1); ++i) {
+    this->threads.emplace_back([this] { run(); });
+  }
+}
+/*
+ * ThreadPoolIO destructor, once the requests submitted are done
+ */
+ThreadPoolIO::~ThreadPoolIO() {
+  {
+    std::lock_guard<std::mutex> guard(queue_lock);
+    closing = true;
+  }
+  queue_ready.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+void ThreadPoolIO::run() {
+  for (;;) {
+    IORequest *request;
+    {
+      std::unique_lock<std::mutex> lock(queue_lock);
+      queue_ready.wait(lock, [&] { return closing || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      request = queue.front();
+      queue.pop_front();
+    }
+    int64_t result;
+    do {
+      switch (request->type) {
+      case IORequest::Read:
+        result = pread(request->fd, request->data, request->length,
+                       (off_t)request->offset);
+        break;
+      case IORequest::Write:
+        result = pwrite(request->fd, request->data, request->length,
+                        (off_t)request->offset);
+        break;
+      default:
+        result = fsync(request->fd);
+        break;
+      }
+    } while (result < 0 && errno == EINTR);
+    {
+      std::lock_guard<std::mutex> guard(completion_lock);
+      request->result = result < 0 ? -errno : result;
+      request->done = true;
+    }
+    completed.notify_all();
+  }
+}
+
+void ThreadPoolIO::submit(IORequest *const *requests, std::size_t count) {
+  {
+    std::lock_guard<std::mutex> guard(queue_lock);
+    for (std::size_t i = 0; i < count; ++i) {
+      requests[i]->done = false;
+      queue.push_back(requests[i]);
+    }
+  }
+  queue_ready.notify_all();
+}
+
+// AsyncDirectory
+
+static uint8_t *allocate_buffer() {
+  void *buffer = std::aligned_alloc(IndexOutput::BufferAlignment,
+                                    IndexOutput::BufferSize);
+  if (!buffer) {
+    throw std::bad_alloc();
+  }
+  return static_cast<uint8_t *>(buffer);
+}
+
+/*
+ * Waits for a read or write and submits what a short transfer left until
+ * all of it is done; throws on an error, or on the end of the file.
+ */
+static void finish(AsyncIO *io, IORequest &request, const std::string &name) {
+  for (;;) {
+    io->wait(&request);
+    if (request.result <= 0) {
+      throw std::runtime_error(
+          std::string(request.type == IORequest::Read ? "Failed to read file: "
+                                                      : "Failed to write file: ") +
+          name);
+    }
+    if ((std::size_t)request.result == request.length) {
+      return;
+    }
+    request.data += request.result;
+    request.length -= request.result;
+    request.offset += request.result;
+    IORequest *rest = &request;
+    io->submit(&rest, 1);
+  }
+}
+
+/*
+ * AsyncIndexOutput writes behind through WriteDepth buffers of its own:
+ * a flushed buffer is copied into the next free one and submitted.
+ */
+class AsyncIndexOutput : public IndexOutput {
+  struct Slot {
+    uint8_t *buffer = nullptr;
+    IORequest request;
+    bool busy = false;
+  };
+  AsyncIO *io; // not owned
+  int fd;
+  Slot slots[AsyncDirectory::WriteDepth];
+  std::size_t next_slot;
+
+  // waits for every write in flight; throws on the first that failed
+  void drain() {
+    for (auto &slot : slots) {
+      if (slot.busy) {
+        slot.busy = false;
+        finish(io, slot.request, get_name());
+      }
+    }
+  }
+
+protected:
+  void write_at(uint64_t offset, const uint8_t *data,
+                std::size_t length) override {
+    Slot &slot = slots[next_slot];
+    next_slot = (next_slot + 1) % AsyncDirectory::WriteDepth;
+    if (slot.busy) {
+      slot.busy = false;
+      finish(io, slot.request, get_name());
+    }
+    std::memcpy(slot.buffer, data, length);
+    slot.request = IORequest();
+    slot.request.type = IORequest::Write;
+    slot.request.fd = fd;
+    slot.request.data = slot.buffer;
+    slot.request.length = length;
+    slot.request.offset = offset;
+    IORequest *request = &slot.request;
+    io->submit(&request, 1);
+    slot.busy = true;
+  }
+
+public:
+  AsyncIndexOutput(AsyncIO *io, const std::string &path,
+                   const std::string &name)
+      : IndexOutput(name), io(io), next_slot(0) {
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to create file: " + path);
+    }
+    for (auto &slot : slots) {
+      slot.buffer = allocate_buffer();
+    }
+  }
+  ~AsyncIndexOutput() override {
+    // the kernel or a pool thread may still be using the buffers
+    for (auto &slot : slots) {
+      if (slot.busy) {
+        io->wait(&slot.request);
+      }
+      std::free(slot.buffer);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+  void close() override {
+    IndexOutput::close();
+    drain();
+    int result = ::close(fd);
+    fd = -1;
+    if (result != 0) {
+      throw std::runtime_error("Failed to close file: " + get_name());
+    }
+  }
+};
+
+/*
+ * AsyncIndexInput reads ahead: after every read it submits the read of the
+ * buffer that follows, which the next sequential read then only waits for.
+ */
+class AsyncIndexInput : public IndexInput {
+  AsyncIO *io; // not owned
+  int fd;
+  uint8_t *ahead;
+  IORequest ahead_request;
+  bool ahead_pending;
+
+protected:
+  void read_at(uint64_t offset, uint8_t *data, std::size_t length) override {
+    bool hit = false;
+    if (ahead_pending) {
+      io->wait(&ahead_request);
+      ahead_pending = false;
+      hit = ahead_request.offset == offset &&
+            ahead_request.result == (int64_t)ahead_request.length &&
+            ahead_request.length >= length;
+    }
+    if (hit) {
+      std::memcpy(data, ahead, length);
+    } else {
+      IORequest request;
+      request.type = IORequest::Read;
+      request.fd = fd;
+      request.data = data;
+      request.length = length;
+      request.offset = offset;
+      IORequest *pointer = &request;
+      io->submit(&pointer, 1);
+      finish(io, request, get_name());
+    }
+    uint64_t next = offset + length;
+    if (next < this->length()) {
+      ahead_request = IORequest();
+      ahead_request.type = IORequest::Read;
+      ahead_request.fd = fd;
+      ahead_request.data = ahead;
+      ahead_request.length = (std::size_t)std::min<uint64_t>(
+          IndexOutput::BufferSize, this->length() - next);
+      ahead_request.offset = next;
+      IORequest *pointer = &ahead_request;
+      io->submit(&pointer, 1);
+      ahead_pending = true;
+    }
+  }
+
+public:
+  AsyncIndexInput(AsyncIO *io, int fd, uint64_t length,
+                  const std::string &name)
+      : IndexInput(name, length), io(io), fd(fd), ahead(allocate_buffer()),
+        ahead_pending(false) {}
+  ~AsyncIndexInput() override {
+    if (ahead_pending) {
+      io->wait(&ahead_request);
+    }
+    std::free(ahead);
+    ::close(fd);
+  }
+};
+
+/*
+ * AsyncDirectory constructor
+ */
+AsyncDirectory::AsyncDirectory(const std::string &directory_name, bool create,
+                               std::unique_ptr<AsyncIO> io)
+    : LocalDirectory(directory_name, create),
+      io(io ? std::move(io) : AsyncIO::create(4)) {}
+/*
+ * AsyncDirectory destructor
+ */
+AsyncDirectory::~AsyncDirectory() = default;
+/*
+ * AsyncDirectory create_output method
+ */
+std::unique_ptr<IndexOutput>
+AsyncDirectory::create_output(const std::string &filename) {
+  return std::make_unique<AsyncIndexOutput>(
+      io.get(), directory_name + "/" + filename, filename);
+}
+/*
+ * AsyncDirectory open_input method
+ */
+std::unique_ptr<IndexInput>
+AsyncDirectory::open_input(const std::string &filename) {
+  std::string path = directory_name + "/" + filename;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  off_t size = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+  if (size < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw std::runtime_error("Failed to open file: " + path);
+  }
+  try {
+    return std::make_unique<AsyncIndexInput>(io.get(), fd, (uint64_t)size,
+                                             filename);
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+}
+/*
+ * AsyncDirectory sync method: all the fsyncs are submitted as one batch
+ */
+void AsyncDirectory::sync(const std::vector<std::string> &filenames) {
+  std::vector<IORequest> requests(filenames.size());
+  std::vector<IORequest *> pointers;
+  auto close_all = [&] {
+    for (const auto &request : requests) {
+      if (request.fd >= 0) {
+        close(request.fd);
+      }
+    }
+  };
+  for (std::size_t i = 0; i < filenames.size(); ++i) {
+    std::string path = directory_name + "/" + filenames[i];
+    requests[i].type = IORequest::Sync;
+    requests[i].fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (requests[i].fd < 0) {
+      close_all();
+      throw std::runtime_error("Failed to open " + path);
+    }
+    pointers.push_back(&requests[i]);
+  }
+  io->submit(pointers.data(), pointers.size());
+  std::string failed;
+  for (auto &request : requests) {
+    io->wait(&request);
+  }
+  for (std::size_t i = 0; i < requests.size(); ++i) {
+    if (requests[i].result < 0 && failed.empty()) {
+      failed = filenames[i];
+    }
+  }
+  close_all();
+  if (!failed.empty()) {
+    throw std::runtime_error("Failed to sync " + directory_name + "/" +
+                             failed);
+  }
+}
@@ -0,0 +1,150 @@
+// asynchronous file I/O: io_uring, or a pool of threads, behind a Directory
+#pragma once
+
+#include "index.h"
+#include "store.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * One read, write or fsync of a file. It belongs to the caller, who must
+ * keep it and its data alive until wait() has returned for it.
+ */
+struct IORequest {
+  enum Type { Read, Write, Sync };
+  Type type = Read;
+  int fd = -1;
+  uint8_t *data = nullptr;
+  std::size_t length = 0;
+  uint64_t offset = 0;
+  // once done: bytes transferred, or -errno
+  int64_t result = 0;
+  bool done = false;
+};
+
+/*
+ * AsyncIO runs IORequests in the background. submit() returns at once;
+ * requests may complete in any order, and run in parallel with each other
+ * and with the caller. Threads can share an AsyncIO.
+ */
+class AsyncIO {
+protected:
+  std::mutex completion_lock;
+  std::condition_variable completed;
+
+public:
+  virtual ~AsyncIO();
+  // starts count requests, batched into as few system calls as the engine
+  // allows
+  virtual void submit(IORequest *const *requests, std::size_t count) = 0;
+  // blocks until request is done
+  void wait(IORequest *request);
+  virtual const char *name() const = 0;
+  // io_uring if the kernel allows it, else a pool of threads
+  static std::unique_ptr<AsyncIO> create(std::size_t threads);
+};
+
+/*
+ * UringIO drives an io_uring through the raw system calls, without
+ * liburing: submit() fills submission queue entries and enters the kernel
+ * once per batch; a completion thread blocks for completions and reaps
+ * them. At most Entries requests are in flight, submit() waits for room
+ * beyond that. The destructor waits for all of them.
+ */
+class UringIO : public AsyncIO {
+  int ring_fd;
+  // submission queue ring, its entries, and the completion queue ring
+  void *sq_ring;
+  std::size_t sq_ring_size;
+  void *sqes;
+  std::size_t sqes_size;
+  void *cq_ring;
+  std::size_t cq_ring_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  void *cqes;
+  std::mutex submit_lock;
+  std::condition_variable room;
+  std::size_t in_flight; // guarded by completion_lock
+  std::thread completion_thread;
+  void release();
+  // whether the kernel runs every operation used, asked once the ring is set up
+  bool supports_operations();
+  // queues an entry for request, a no-op for nullptr; needs submit_lock
+  void push(IORequest *request);
+  unsigned enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+  // returns false once the no-op of the destructor is reaped
+  bool reap();
+
+public:
+  static constexpr unsigned Entries = 128;
+
+  // throws if the kernel has no io_uring, does not let us use it, or lacks
+  // an operation used (before Linux 5.6)
+  UringIO();
+  ~UringIO() override;
+  void submit(IORequest *const *requests, std::size_t count) override;
+  const char *name() const override { return "io_uring"; }
+};
+
+/*
+ * ThreadPoolIO runs every request with a blocking pread, pwrite or fsync
+ * on one of its threads.
+ */
+class ThreadPoolIO : public AsyncIO {
+  std::mutex queue_lock;
+  std::condition_variable queue_ready;
+  std::deque<IORequest *> queue;
+  bool closing;
+  std::vector<std::thread> threads;
+  void run();
+
+public:
+  ThreadPoolIO(std::size_t threads);
+  ~ThreadPoolIO() override;
+  void submit(IORequest *const *requests, std::size_t count) override;
+  const char *name() const override { return "threads"; }
+};
+
+/*
+ * AsyncDirectory is a LocalDirectory whose file I/O goes through an
+ * AsyncIO:
+ * - outputs write behind: a full buffer is handed to the AsyncIO and the
+ *   writer goes on encoding into the next, with up to WriteDepth buffers
+ *   of every open file in flight, so the files of a flush or merge are
+ *   written while the codec encodes;
+ * - inputs read ahead the buffer after the one being read;
+ * - sync() starts the fsyncs of all the files at once.
+ * Files are still mapped for searching: postings are read through the page
+ * cache.
+ */
+class AsyncDirectory : public LocalDirectory {
+  std::unique_ptr<AsyncIO> io;
+
+public:
+  static constexpr std::size_t WriteDepth = 4;
+
+  // creates the directory, or opens an existing one if create is false;
+  // io defaults to AsyncIO::create(4)
+  AsyncDirectory(const std::string &directory_name, bool create = true,
+                 std::unique_ptr<AsyncIO> io = nullptr);
+  ~AsyncDirectory() override;
+  const char *engine_name() const { return io->name(); }
+  std::unique_ptr<IndexOutput>
+  create_output(const std::string &filename) override;
+  std::unique_ptr<IndexInput>
+  open_input(const std::string &filename) override;
+  void sync(const std::vector<std::string> &filenames) override;
+};
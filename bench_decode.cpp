@@ -0,0 +1,124 @@
+// decode microbenchmark: integers per second of every block kernel
+#include "bitpacking.h"
+#include "pfor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+// Packed blocks per run, 32 KB of integers: decoding targets a small buffer
+// that stays in cache, as in a postings iterator.
+const size_t Blocks = 64;
+// Passes over the blocks per measurement.
+const int Rounds = 3000;
+
+// 32-byte stores of the AVX2 kernel must not straddle cache lines.
+alignas(64) static uint32_t decoded[Blocks * PostingsBlockSize];
+
+/*
+ * Run fn over every block Rounds times and return millions of integers
+ * decoded per second.
+ */
+template <typename Fn> double measure(Fn fn) {
+  fn(); // warm up
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < Rounds; ++round) {
+    fn();
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  return (double)Blocks * PostingsBlockSize * Rounds / seconds / 1e6;
+}
+
+int main() {
+  std::mt19937 random(42);
+  const BlockKernel kernels[] = {BlockKernel::Scalar, BlockKernel::SSE4,
+                                 BlockKernel::AVX2};
+  std::vector<uint32_t> values(Blocks * PostingsBlockSize);
+  std::vector<uint8_t> packed(Blocks * PostingsBlockSize * 4);
+  uint32_t checksum = 0;
+
+  printf("default kernel: %s\n", block_kernel_name(get_block_kernel()));
+  printf("unpack, M ints/s\n%5s", "bits");
+  for (auto kernel : kernels) {
+    printf(" %10s", block_kernel_name(kernel));
+  }
+  printf("\n");
+  for (int bits : {1, 2, 4, 5, 7, 8, 11, 12, 16, 20, 24, 32}) {
+    uint64_t limit = 1ull << bits;
+    for (auto &value : values) {
+      value = (uint32_t)(random() % limit);
+    }
+    size_t block_bytes = PostingsBlockSize * bits / 8;
+    for (size_t block = 0; block < Blocks; ++block) {
+      pack_bits(&values[block * PostingsBlockSize], bits,
+                &packed[block * block_bytes]);
+    }
+    printf("%5d", bits);
+    for (auto kernel : kernels) {
+      if (!block_kernel_supported(kernel)) {
+        printf(" %10s", "-");
+        continue;
+      }
+      set_block_kernel(kernel);
+      double rate = measure([&] {
+        for (size_t block = 0; block < Blocks; ++block) {
+          unpack_bits(&packed[block * block_bytes], bits,
+                      &decoded[block * PostingsBlockSize]);
+        }
+      });
+      checksum += decoded[random() % (Blocks * PostingsBlockSize)];
+      printf(" %10.0f", rate);
+    }
+    printf("\n");
+  }
+
+  // docid gaps as in a postings list: mostly small, a few large
+  std::geometric_distribution<uint32_t> gaps(0.05);
+  for (auto &value : values) {
+    value = 1 + gaps(random);
+  }
+  std::string blocks;
+  for (size_t block = 0; block < Blocks; ++block) {
+    pfor_encode(&values[block * PostingsBlockSize], blocks);
+  }
+  printf("\n%-24s", "M ints/s");
+  for (auto kernel : kernels) {
+    printf(" %10s", block_kernel_name(kernel));
+  }
+  printf("\n");
+  const char *names[] = {"prefix sum", "pfor decode + prefix sum"};
+  for (int test = 0; test < 2; ++test) {
+    printf("%-24s", names[test]);
+    for (auto kernel : kernels) {
+      if (!block_kernel_supported(kernel)) {
+        printf(" %10s", "-");
+        continue;
+      }
+      set_block_kernel(kernel);
+      double rate = measure([&] {
+        const uint8_t *in = (const uint8_t *)blocks.data();
+        uint32_t docid = 0;
+        for (size_t block = 0; block < Blocks; ++block) {
+          uint32_t *out = &decoded[block * PostingsBlockSize];
+          if (test == 0) {
+            std::copy_n(&values[block * PostingsBlockSize],
+                        PostingsBlockSize, out);
+          } else {
+            in = pfor_decode(in, out);
+          }
+          docid = prefix_sum(out, PostingsBlockSize, docid);
+        }
+        checksum += docid;
+      });
+      printf(" %10.0f", rate);
+    }
+    printf("\n");
+  }
+  printf("checksum %u\n", checksum);
+  return 0;
+}
@@ -0,0 +1,306 @@
+#include "bitpacking.h"
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+// Rows of a block, values per lane.
+static constexpr int Rows = PostingsBlockSize / 4;
+
+int bits_required(uint32_t value) {
+  return value == 0 ? 0 : 32 - __builtin_clz(value);
+}
+
+static uint32_t load_u32(const uint8_t *p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+void pack_bits(const uint32_t *values, int bits, uint8_t *out) {
+  uint32_t words[PostingsBlockSize] = {};
+  for (int lane = 0; lane < 4; ++lane) {
+    for (int row = 0; row < Rows; ++row) {
+      uint32_t value = values[row * 4 + lane];
+      int bit = row * bits;
+      int word = bit >> 5;
+      int shift = bit & 31;
+      words[word * 4 + lane] |= value << shift;
+      if (shift + bits > 32) {
+        words[(word + 1) * 4 + lane] |= value >> (32 - shift);
+      }
+    }
+  }
+  std::memcpy(out, words, PostingsBlockSize * bits / 8);
+}
+
+// Scalar kernels
+
+static void unpack_scalar(const uint8_t *in, int bits, uint32_t *values) {
+  if (bits == 0) {
+    std::memset(values, 0, PostingsBlockSize * sizeof(uint32_t));
+    return;
+  }
+  uint32_t mask = bits == 32 ? ~0u : (1u << bits) - 1;
+  for (int lane = 0; lane < 4; ++lane) {
+    for (int row = 0; row < Rows; ++row) {
+      int bit = row * bits;
+      int word = bit >> 5;
+      int shift = bit & 31;
+      uint32_t value = load_u32(in + (word * 4 + lane) * 4) >> shift;
+      if (shift + bits > 32) {
+        value |= load_u32(in + ((word + 1) * 4 + lane) * 4) << (32 - shift);
+      }
+      values[row * 4 + lane] = value & mask;
+    }
+  }
+}
+
+static uint32_t prefix_sum_scalar(uint32_t *values, std::size_t count,
+                                  uint32_t base) {
+  for (std::size_t i = 0; i < count; ++i) {
+    base += values[i];
+    values[i] = base;
+  }
+  return base;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// SSE4 kernels: one 128-bit word holds word k of the four lanes, so every
+// row of four values is one or two shifts. Bits is a template parameter and
+// the rows are unrolled, so all shifts and offsets are constants.
+
+template <int Bits>
+__attribute__((target("sse4.1"))) static void
+unpack_sse4(const uint8_t *in, uint32_t *values) {
+  const __m128i *src = reinterpret_cast<const __m128i *>(in);
+  __m128i *dst = reinterpret_cast<__m128i *>(values);
+  if constexpr (Bits == 0) {
+    for (int row = 0; row < Rows; ++row) {
+      _mm_storeu_si128(dst + row, _mm_setzero_si128());
+    }
+  } else if constexpr (Bits == 32) {
+    for (int row = 0; row < Rows; ++row) {
+      _mm_storeu_si128(dst + row, _mm_loadu_si128(src + row));
+    }
+  } else {
+    const __m128i mask = _mm_set1_epi32((1u << Bits) - 1);
+#pragma GCC unroll 32
+    for (int row = 0; row < Rows; ++row) {
+      const int bit = row * Bits;
+      const int word = bit >> 5;
+      const int shift = bit & 31;
+      __m128i value = _mm_srli_epi32(_mm_loadu_si128(src + word), shift);
+      if (shift + Bits > 32) {
+        value = _mm_or_si128(
+            value,
+            _mm_slli_epi32(_mm_loadu_si128(src + word + 1), 32 - shift));
+      }
+      _mm_storeu_si128(dst + row, _mm_and_si128(value, mask));
+    }
+  }
+}
+
+__attribute__((target("sse4.1"))) static uint32_t
+prefix_sum_sse4(uint32_t *values, std::size_t count, uint32_t base) {
+  __m128i carry = _mm_set1_epi32(base);
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i *p = reinterpret_cast<__m128i *>(values + i);
+    __m128i x = _mm_loadu_si128(p);
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi32(x, carry);
+    _mm_storeu_si128(p, x);
+    carry = _mm_shuffle_epi32(x, 0xff);
+  }
+  return prefix_sum_scalar(values + i, count - i, _mm_cvtsi128_si32(carry));
+}
+
+// AVX2 kernels: rows r and r + 1 are unpacked together, one in each half
+// of a 256-bit register. Their bits start in the same 16 byte word or in
+// two adjacent ones, so one broadcast or one unaligned load fetches both,
+// and per-half shift counts (vpsrlvd/vpsllvd) align them.
+
+__attribute__((target("avx2"))) static inline __m256i
+load_words(const __m128i *src, int low, int high) {
+  // high is low or low + 1
+  if (low == high) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(src + low));
+  }
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + low));
+}
+
+template <int Bits>
+__attribute__((target("avx2"))) static void
+unpack_avx2(const uint8_t *in, uint32_t *values) {
+  const __m128i *src = reinterpret_cast<const __m128i *>(in);
+  __m256i *dst = reinterpret_cast<__m256i *>(values);
+  if constexpr (Bits == 0 || Bits == 32) {
+    unpack_sse4<Bits>(in, values);
+  } else {
+    const __m256i mask = _mm256_set1_epi32((1u << Bits) - 1);
+#pragma GCC unroll 16
+    for (int pair = 0; pair < Rows / 2; ++pair) {
+      const int low_bit = 2 * pair * Bits;
+      const int high_bit = low_bit + Bits;
+      const int low_word = low_bit >> 5, low_shift = low_bit & 31;
+      const int high_word = high_bit >> 5, high_shift = high_bit & 31;
+      __m256i value = _mm256_srlv_epi32(
+          load_words(src, low_word, high_word),
+          _mm256_setr_epi32(low_shift, low_shift, low_shift, low_shift,
+                            high_shift, high_shift, high_shift, high_shift));
+      const bool low_spills = low_shift + Bits > 32;
+      const bool high_spills = high_shift + Bits > 32;
+      if (low_spills || high_spills) {
+        // a shift count of 32 clears the half that does not spill, whose
+        // word is then only loaded to stay within the block
+        const int low_next = low_spills ? low_word + 1 : high_word + 1;
+        const int high_next = high_spills ? high_word + 1 : low_word + 1;
+        const int low_count = low_spills ? 32 - low_shift : 32;
+        const int high_count = high_spills ? 32 - high_shift : 32;
+        value = _mm256_or_si256(
+            value,
+            _mm256_sllv_epi32(
+                load_words(src, low_next,
+                                 low_spills && high_spills ? high_next
+                                                           : low_next),
+                _mm256_setr_epi32(low_count, low_count, low_count, low_count,
+                                  high_count, high_count, high_count,
+                                  high_count)));
+      }
+      _mm256_storeu_si256(dst + pair, _mm256_and_si256(value, mask));
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static uint32_t
+prefix_sum_avx2(uint32_t *values, std::size_t count, uint32_t base) {
+  __m256i carry = _mm256_set1_epi32(base);
+  const __m256i last_of_low = _mm256_set1_epi32(3);
+  const __m256i last = _mm256_set1_epi32(7);
+  const __m256i high_half = _mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1);
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i *p = reinterpret_cast<__m256i *>(values + i);
+    __m256i x = _mm256_loadu_si256(p);
+    // prefix sums within each half, then the low half's total to the high
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+    x = _mm256_add_epi32(
+        x, _mm256_and_si256(_mm256_permutevar8x32_epi32(x, last_of_low),
+                            high_half));
+    x = _mm256_add_epi32(x, carry);
+    _mm256_storeu_si256(p, x);
+    carry = _mm256_permutevar8x32_epi32(x, last);
+  }
+  return prefix_sum_scalar(values + i, count - i,
+                           _mm256_cvtsi256_si32(carry));
+}
+
+typedef void (*UnpackFn)(const uint8_t *, uint32_t *);
+
+template <std::size_t... Bits>
+static constexpr std::array<UnpackFn, sizeof...(Bits)>
+sse4_table(std::index_sequence<Bits...>) {
+  return {&unpack_sse4<Bits>...};
+}
+template <std::size_t... Bits>
+static constexpr std::array<UnpackFn, sizeof...(Bits)>
+avx2_table(std::index_sequence<Bits...>) {
+  return {&unpack_avx2<Bits>...};
+}
+// indexed by bits, 0 to 32
+static constexpr auto UnpackSse4 = sse4_table(std::make_index_sequence<33>());
+static constexpr auto UnpackAvx2 = avx2_table(std::make_index_sequence<33>());
+
+#endif
+
+// Dispatch
+
+static BlockKernel detect_block_kernel() {
+#ifdef HAVE_X86_KERNELS
+  // runs from a static initializer, possibly before libgcc's own
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return BlockKernel::AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return BlockKernel::SSE4;
+  }
+#endif
+  return BlockKernel::Scalar;
+}
+
+static BlockKernel current_kernel = detect_block_kernel();
+
+const char *block_kernel_name(BlockKernel kernel) {
+  switch (kernel) {
+  case BlockKernel::SSE4:
+    return "sse4";
+  case BlockKernel::AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+bool block_kernel_supported(BlockKernel kernel) {
+#ifdef HAVE_X86_KERNELS
+  switch (kernel) {
+  case BlockKernel::SSE4:
+    return __builtin_cpu_supports("sse4.1");
+  case BlockKernel::AVX2:
+    return __builtin_cpu_supports("avx2");
+  default:
+    return true;
+  }
+#else
+  return kernel == BlockKernel::Scalar;
+#endif
+}
+
+BlockKernel get_block_kernel() { return current_kernel; }
+
+void set_block_kernel(BlockKernel kernel) {
+  if (!block_kernel_supported(kernel)) {
+    throw std::runtime_error(std::string("Kernel not supported by this CPU: ") +
+                             block_kernel_name(kernel));
+  }
+  current_kernel = kernel;
+}
+
+void unpack_bits(const uint8_t *in, int bits, uint32_t *values) {
+  switch (current_kernel) {
+#ifdef HAVE_X86_KERNELS
+  case BlockKernel::AVX2:
+    UnpackAvx2[bits](in, values);
+    return;
+  case BlockKernel::SSE4:
+    UnpackSse4[bits](in, values);
+    return;
+#endif
+  default:
+    unpack_scalar(in, bits, values);
+  }
+}
+
+uint32_t prefix_sum(uint32_t *values, std::size_t count, uint32_t base) {
+  switch (current_kernel) {
+#ifdef HAVE_X86_KERNELS
+  case BlockKernel::AVX2:
+    return prefix_sum_avx2(values, count, base);
+  case BlockKernel::SSE4:
+    return prefix_sum_sse4(values, count, base);
+#endif
+  default:
+    return prefix_sum_scalar(values, count, base);
+  }
+}
@@ -0,0 +1,41 @@
+// bit packing of postings blocks with SIMD kernels
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Integers per packed block of postings.
+constexpr std::size_t PostingsBlockSize = 128;
+
+// number of bits needed to store value (0 for 0)
+int bits_required(uint32_t value);
+
+/*
+ * A block of PostingsBlockSize values of `bits` bits each takes
+ * PostingsBlockSize * bits / 8 bytes, laid out as in SIMD-BP128: value i
+ * goes to lane i % 4 and row i / 4; every lane is a stream of 32-bit words
+ * filled from the least significant bit, and word k of the four lanes is
+ * stored together as 16 bytes. A 128-bit register thus unpacks four values
+ * per shift, and an AVX2 register eight.
+ */
+void pack_bits(const uint32_t *values, int bits, uint8_t *out);
+
+/*
+ * Unpack kernels. The best one the CPU supports is picked at startup;
+ * set_block_kernel() overrides it, e.g. to benchmark the others. It must not
+ * be called while other threads decode.
+ */
+enum class BlockKernel { Scalar, SSE4, AVX2 };
+const char *block_kernel_name(BlockKernel kernel);
+bool block_kernel_supported(BlockKernel kernel);
+BlockKernel get_block_kernel();
+void set_block_kernel(BlockKernel kernel);
+
+void unpack_bits(const uint8_t *in, int bits, uint32_t *values);
+
+/*
+ * In place inclusive prefix sum turning deltas into values:
+ * values[i] = base + values[0] + ... + values[i]. Returns values[count - 1]
+ * (or base), the base of the next block. Uses the current kernel.
+ */
+uint32_t prefix_sum(uint32_t *values, std::size_t count, uint32_t base);
@@ -0,0 +1,851 @@
+#include "codec.h"
+#include "pfor.h"
+#include "terms.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+
+/*
+ * TextCodec constructor
+ */
+TextCodec::TextCodec() = default;
+/*
+ * TextCodec destructor
+ */
+TextCodec::~TextCodec() = default;
+/*
+ * TextCodec encode_term_dictionarie method
+ */
+std::vector<std::string> TextCodec::encode_term_dictionarie(
+    Directory *directory, const std::string &segment_name,
+    std::unordered_map<std::string, TermDictionary> &term_dictionaries) {
+  std::cout << "Encoding term dictionary..." << std::endl;
+  std::vector<std::string> filenames;
+  for (const auto &[field_name, term_dictionary] : term_dictionaries) {
+    std::string filename = segment_name + "." + field_name + ".txt";
+    auto output = directory->create_output(filename);
+    term_dictionary.write_to(*output);
+    output->close();
+    filenames.push_back(filename);
+  }
+  return filenames;
+}
+/*
+ * TextCodec decode_term_dictionary method
+ */
+std::unique_ptr<FieldReader>
+TextCodec::decode_term_dictionary(Directory *directory,
+                                  const std::string &segment_name,
+                                  const std::string &field_name) {
+  throw std::runtime_error("Text segments cannot be read, index with -f "
+                           "binary");
+}
+/*
+ * TextCodec merge_segments method
+ */
+std::vector<std::string>
+TextCodec::merge_segments(Directory *directory, const std::string &segment_name,
+                          const std::vector<SegmentInfos> &segments) {
+  throw std::runtime_error("Text segments cannot be merged");
+}
+
+/*
+ * BinaryCodec constructor
+ */
+BinaryCodec::BinaryCodec() = default;
+/*
+ * BinaryCodec destructor
+ */
+BinaryCodec::~BinaryCodec() = default;
+
+uint8_t encode_norm(uint64_t length) {
+  // lengths from 24 on: 3 bits of shift and the 3 bits below the top one
+  const uint64_t Exact = 24;
+  if (length < Exact) {
+    return (uint8_t)length;
+  }
+  uint64_t rest = length - Exact;
+  int bits = 64 - __builtin_clzll(rest | 1);
+  if (bits < 4) {
+    return (uint8_t)(Exact + rest);
+  }
+  int shift = bits - 4;
+  uint64_t encoded = Exact + (((uint64_t)(shift + 1) << 3) |
+                              ((rest >> shift) & 0x07));
+  return (uint8_t)std::min<uint64_t>(encoded, 255);
+}
+
+uint64_t decode_norm(uint8_t norm) {
+  const uint64_t Exact = 24;
+  if (norm < Exact) {
+    return norm;
+  }
+  uint64_t rest = norm - Exact;
+  int shift = (int)(rest >> 3) - 1;
+  uint64_t bits = rest & 0x07;
+  return Exact + (shift < 0 ? bits : (bits | 0x08) << shift);
+}
+
+void Impact::add(uint32_t freq, uint8_t norm) {
+  max_freq = std::max(max_freq, freq);
+  min_norm = std::min(min_norm, norm);
+}
+
+// blocks hold 32-bit values
+static uint32_t checked_u32(uint64_t value) {
+  if (value > UINT32_MAX) {
+    throw std::runtime_error("Postings delta does not fit in 32 bits");
+  }
+  return (uint32_t)value;
+}
+
+/*
+ * Append full PFOR blocks of every stream, interleaved block by block, then
+ * the remaining values as VInts, interleaved value by value. Returns where
+ * every block and the VInts start in out.
+ */
+static std::vector<std::size_t>
+write_postings(std::string &out,
+               std::initializer_list<const std::vector<uint32_t> *> streams) {
+  std::size_t count = (*streams.begin())->size();
+  std::size_t blocked = count - count % PostingsBlockSize;
+  std::vector<std::size_t> starts;
+  for (std::size_t i = 0; i < blocked; i += PostingsBlockSize) {
+    starts.push_back(out.size());
+    for (const auto *stream : streams) {
+      pfor_encode(stream->data() + i, out);
+    }
+  }
+  starts.push_back(out.size());
+  for (std::size_t i = blocked; i < count; ++i) {
+    for (const auto *stream : streams) {
+      write_vint(out, (*stream)[i]);
+    }
+  }
+  return starts;
+}
+
+/*
+ * A field's norms from first_docid on, see BinaryCodec.
+ */
+struct Norms {
+  docid_t first_docid = 0;
+  std::vector<uint8_t> bytes;
+  uint8_t get(docid_t docid) const { return bytes[docid - first_docid]; }
+};
+
+/*
+ * Append the length and the skip data of a term's postings (see SkipReader)
+ * given where its doc and position blocks start, relative to the first, and
+ * where its docs end.
+ */
+static void write_skip_data(std::string &out,
+                            const std::vector<uint32_t> &doc_deltas,
+                            const std::vector<uint32_t> &freqs,
+                            const Norms &norms,
+                            const std::vector<std::size_t> &doc_blocks,
+                            std::size_t docs_end,
+                            const std::vector<std::size_t> &position_blocks) {
+  // level 0: every block, the last one may be partial
+  std::vector<SkipReader::Entry> entries;
+  SkipReader::Entry entry;
+  Impact max_impact;
+  for (std::size_t i = 0; i < doc_deltas.size();) {
+    entry.impact = Impact();
+    for (std::size_t end = std::min(i + PostingsBlockSize, doc_deltas.size());
+         i < end; ++i) {
+      entry.docid += doc_deltas[i];
+      entry.positions += freqs[i];
+      entry.impact.add(freqs[i], norms.get(entry.docid));
+    }
+    max_impact.add(entry.impact.max_freq, entry.impact.min_norm);
+    entry.docs = i;
+    entry.doc_offset = i < doc_deltas.size() ? doc_blocks[i / PostingsBlockSize]
+                                             : docs_end;
+    entry.pos_offset = position_blocks[entry.positions / PostingsBlockSize];
+    entries.push_back(entry);
+  }
+  std::vector<std::string> levels;
+  // per level below, per entry of it, the offset after it
+  std::vector<std::vector<uint64_t>> children;
+  for (uint64_t interval = 1;
+       levels.size() < (std::size_t)SkipReader::MaxSkipLevels &&
+       interval <= entries.size();
+       interval *= SkipReader::SkipMultiplier) {
+    std::string level;
+    std::vector<uint64_t> ends(entries.size());
+    SkipReader::Entry previous;
+    for (std::size_t i = interval - 1; i < entries.size(); i += interval) {
+      const auto &entry = entries[i];
+      write_vint(level, entry.docid - previous.docid);
+      write_vint(level, entry.doc_offset - previous.doc_offset);
+      write_vint(level, entry.positions - previous.positions);
+      write_vint(level, entry.pos_offset - previous.pos_offset);
+      if (interval > 1) {
+        for (auto below = children.rbegin(); below != children.rend();
+             ++below) {
+          write_vint(level, (*below)[i]);
+        }
+      } else {
+        write_vint(level, entry.impact.max_freq);
+        level.push_back((char)entry.impact.min_norm);
+      }
+      ends[i] = level.size();
+      previous = entry;
+    }
+    levels.push_back(std::move(level));
+    children.push_back(std::move(ends));
+  }
+  std::string skip_data;
+  write_vint(skip_data, levels.size());
+  write_vint(skip_data, max_impact.max_freq);
+  skip_data.push_back((char)max_impact.min_norm);
+  for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+    write_vint(skip_data, level->size());
+    skip_data += *level;
+  }
+  write_vint(out, skip_data.size());
+  out += skip_data;
+}
+
+/*
+ * FieldWriter writes the files of one field of a BinaryCodec segment from
+ * its norms and its terms, added in sorted order with their postings. The
+ * files are streamed through IndexOutputs; only the postings of the term
+ * being added are held in memory, as its skip data precedes them and
+ * depends on their layout.
+ */
+class FieldWriter {
+  Norms norms;
+  std::unique_ptr<IndexOutput> terms_output;
+  std::unique_ptr<IndexOutput> index_output;
+  std::unique_ptr<IndexOutput> docs;
+  std::unique_ptr<IndexOutput> positions;
+  std::unique_ptr<IndexOutput> norms_output;
+  TermsWriter terms_writer;
+  // of the term being added
+  std::string term_skip_data;
+  std::string term_docs;
+  std::string term_positions;
+
+public:
+  // prefix is "<segment>.<field>"
+  FieldWriter(Directory *directory, const std::string &prefix, Norms norms,
+              uint64_t doc_count, uint64_t sum_total_term_freq)
+      : norms(std::move(norms)),
+        terms_output(directory->create_output(prefix + ".tim")),
+        index_output(directory->create_output(prefix + ".tip")),
+        docs(directory->create_output(prefix + ".doc")),
+        positions(directory->create_output(prefix + ".pos")),
+        norms_output(directory->create_output(prefix + ".nrm")),
+        terms_writer(terms_output.get(), index_output.get()) {
+    docs->write_bytes(BinaryCodec::DocsMagic, 4);
+    positions->write_bytes(BinaryCodec::PositionsMagic, 4);
+    norms_output->write_bytes(BinaryCodec::NormsMagic, 4);
+    norms_output->write_vint(doc_count);
+    norms_output->write_vint(sum_total_term_freq);
+    norms_output->write_vint(this->norms.first_docid);
+    norms_output->write_vint(this->norms.bytes.size());
+    norms_output->write_bytes(this->norms.bytes.data(),
+                              this->norms.bytes.size());
+  }
+  // position deltas from 0 in every doc
+  void add_term(std::string_view term, const std::vector<uint32_t> &doc_deltas,
+                const std::vector<uint32_t> &freqs,
+                const std::vector<uint32_t> &position_deltas) {
+    TermInfo info;
+    info.doc_freq = doc_deltas.size();
+    info.total_term_freq = position_deltas.size();
+    info.doc_offset = docs->get_file_pointer();
+    info.pos_offset = positions->get_file_pointer();
+    terms_writer.add(term, info);
+    term_docs.clear();
+    term_positions.clear();
+    auto doc_blocks = write_postings(term_docs, {&doc_deltas, &freqs});
+    auto position_blocks = write_postings(term_positions, {&position_deltas});
+    if (doc_deltas.size() > PostingsBlockSize) {
+      term_skip_data.clear();
+      write_skip_data(term_skip_data, doc_deltas, freqs, norms, doc_blocks,
+                      term_docs.size(), position_blocks);
+      docs->write_bytes(term_skip_data);
+    }
+    docs->write_bytes(term_docs);
+    positions->write_bytes(term_positions);
+  }
+  // ends the files with their footers and adds their names to filenames
+  void finish(std::vector<std::string> &filenames) {
+    terms_writer.finish();
+    for (auto *output : {terms_output.get(), index_output.get(), docs.get(),
+                         positions.get(), norms_output.get()}) {
+      output->write_footer();
+      output->close();
+      filenames.push_back(output->get_name());
+    }
+  }
+};
+
+/*
+ * BinaryCodec encode_term_dictionarie method
+ */
+std::vector<std::string> BinaryCodec::encode_term_dictionarie(
+    Directory *directory, const std::string &segment_name,
+    std::unordered_map<std::string, TermDictionary> &term_dictionaries) {
+  std::cout << "Encoding term dictionary..." << std::endl;
+  std::vector<std::string> filenames;
+  std::vector<uint32_t> doc_deltas;
+  std::vector<uint32_t> freqs;
+  std::vector<uint32_t> position_deltas;
+  for (const auto &[field_name, term_dictionary] : term_dictionaries) {
+    std::vector<std::size_t> ids(term_dictionary.size());
+    std::iota(ids.begin(), ids.end(), 0);
+    std::sort(ids.begin(), ids.end(), [&](std::size_t a, std::size_t b) {
+      return term_dictionary.get_word(a) < term_dictionary.get_word(b);
+    });
+
+    // norms, from the first doc with the field to the last
+    const auto &length_docids = term_dictionary.get_length_docids();
+    const auto &lengths = term_dictionary.get_lengths();
+    Norms norms;
+    uint64_t sum_total_term_freq = 0;
+    if (!length_docids.empty()) {
+      norms.first_docid = length_docids.front();
+      norms.bytes.resize(length_docids.back() - norms.first_docid + 1);
+    }
+    for (std::size_t i = 0; i < length_docids.size(); ++i) {
+      norms.bytes[length_docids[i] - norms.first_docid] =
+          encode_norm(lengths[i]);
+      sum_total_term_freq += lengths[i];
+    }
+
+    FieldWriter field_writer(directory, segment_name + "." + field_name,
+                             std::move(norms), length_docids.size(),
+                             sum_total_term_freq);
+    for (std::size_t id : ids) {
+      doc_deltas.clear();
+      freqs.clear();
+      position_deltas.clear();
+      docid_t last_docid = 0;
+      term_dictionary.read_postings(
+          id, [&](const docid_t &docid, const std::vector<term_id_t> &term_ids) {
+            doc_deltas.push_back(checked_u32(docid - last_docid));
+            freqs.push_back(checked_u32(term_ids.size()));
+            last_docid = docid;
+            term_id_t last_term_id = 0;
+            for (const auto &term_id : term_ids) {
+              position_deltas.push_back(checked_u32(term_id - last_term_id));
+              last_term_id = term_id;
+            }
+          });
+      field_writer.add_term(term_dictionary.get_word(id), doc_deltas, freqs,
+                            position_deltas);
+    }
+    field_writer.finish(filenames);
+  }
+  return filenames;
+}
+
+/*
+ * BinaryCodec merge_segments method. Every field is merged on its own: the
+ * sorted terms of the sources are walked side by side and the postings of
+ * a term found in several of them are interleaved by docid, docids being
+ * global. Norms and field statistics are combined, not recomputed.
+ */
+std::vector<std::string>
+BinaryCodec::merge_segments(Directory *directory,
+                            const std::string &segment_name,
+                            const std::vector<SegmentInfos> &segments) {
+  std::set<std::string> field_names;
+  for (const auto &segment : segments) {
+    for (const auto &field_name : segment.get_field_names()) {
+      field_names.insert(field_name);
+    }
+  }
+  std::vector<std::string> filenames;
+  std::vector<uint32_t> doc_deltas;
+  std::vector<uint32_t> freqs;
+  std::vector<uint32_t> position_deltas;
+  for (const auto &field_name : field_names) {
+    std::vector<std::unique_ptr<FieldReader>> readers;
+    for (const auto &segment : segments) {
+      const auto names = segment.get_field_names();
+      if (std::binary_search(names.begin(), names.end(), field_name)) {
+        readers.push_back(
+            decode_term_dictionary(directory, segment.get_name(), field_name));
+        // a corrupt source would be copied into the merged segment
+        readers.back()->check_integrity();
+      }
+    }
+
+    Norms norms;
+    uint64_t doc_count = 0;
+    uint64_t sum_total_term_freq = 0;
+    docid_t end = 0;
+    norms.first_docid = PostingsIterator::NoMoreDocs;
+    for (const auto &reader : readers) {
+      doc_count += reader->get_doc_count();
+      sum_total_term_freq += reader->get_sum_total_term_freq();
+      if (reader->get_docid_span() > 0) {
+        norms.first_docid =
+            std::min(norms.first_docid, reader->get_first_docid());
+        end = std::max(end,
+                       reader->get_first_docid() + reader->get_docid_span());
+      }
+    }
+    if (end == 0) {
+      norms.first_docid = 0;
+    }
+    norms.bytes.resize(end - norms.first_docid);
+    // a doc has the field in at most one source, the others give it 0
+    for (const auto &reader : readers) {
+      for (docid_t docid = reader->get_first_docid(),
+                   last = docid + reader->get_docid_span();
+           docid < last; ++docid) {
+        norms.bytes[docid - norms.first_docid] |= reader->norm(docid);
+      }
+    }
+
+    FieldWriter field_writer(directory, segment_name + "." + field_name,
+                             std::move(norms), doc_count,
+                             sum_total_term_freq);
+    std::vector<TermsEnum> terms;
+    std::vector<std::size_t> live; // sources with terms left
+    for (std::size_t i = 0; i < readers.size(); ++i) {
+      terms.push_back(readers[i]->get_terms().all());
+      if (terms.back().next()) {
+        live.push_back(i);
+      }
+    }
+    std::vector<std::size_t> matching; // sources on the smallest term
+    std::vector<PostingsIterator> postings;
+    std::string term;
+    while (!live.empty()) {
+      term = terms[live[0]].term();
+      for (std::size_t i : live) {
+        if (terms[i].term() < term) {
+          term = terms[i].term();
+        }
+      }
+      matching.clear();
+      postings.clear();
+      for (std::size_t i : live) {
+        if (terms[i].term() == term) {
+          matching.push_back(i);
+          postings.push_back(readers[i]->postings(terms[i].term_info()));
+          postings.back().next_doc();
+        }
+      }
+      doc_deltas.clear();
+      freqs.clear();
+      position_deltas.clear();
+      docid_t last_docid = 0;
+      for (;;) {
+        PostingsIterator *lowest = nullptr;
+        for (auto &iterator : postings) {
+          if (!lowest || iterator.docid() < lowest->docid()) {
+            lowest = &iterator;
+          }
+        }
+        if (lowest->docid() == PostingsIterator::NoMoreDocs) {
+          break;
+        }
+        doc_deltas.push_back(checked_u32(lowest->docid() - last_docid));
+        freqs.push_back(lowest->freq());
+        last_docid = lowest->docid();
+        term_id_t last_position = 0;
+        for (term_id_t position : lowest->get_positions()) {
+          position_deltas.push_back(checked_u32(position - last_position));
+          last_position = position;
+        }
+        lowest->next_doc();
+      }
+      field_writer.add_term(term, doc_deltas, freqs, position_deltas);
+      for (std::size_t i : matching) {
+        if (!terms[i].next()) {
+          live.erase(std::find(live.begin(), live.end(), i));
+        }
+      }
+    }
+    field_writer.finish(filenames);
+  }
+  return filenames;
+}
+
+/*
+ * BinaryCodec decode_term_dictionary method
+ */
+std::unique_ptr<FieldReader>
+BinaryCodec::decode_term_dictionary(Directory *directory,
+                                    const std::string &segment_name,
+                                    const std::string &field_name) {
+  return std::make_unique<FieldReader>(directory,
+                                       segment_name + "." + field_name);
+}
+
+/*
+ * SkipReader constructor
+ */
+SkipReader::SkipReader() : level_count(0), entries_read(0) {}
+
+void SkipReader::reset(const uint8_t *data, uint64_t doc_freq) {
+  this->doc_freq = doc_freq;
+  entries_read = 0;
+  level_count = (int)read_vint(data);
+  max_impact.max_freq = (uint32_t)read_vint(data);
+  max_impact.min_norm = *data++;
+  for (int level = level_count - 1; level >= 0; --level) {
+    uint64_t length = read_vint(data);
+    starts[level] = ins[level] = data;
+    ends[level] = data + length;
+    data += length;
+    previous[level] = Entry();
+    load_next(level);
+  }
+  last = Entry();
+}
+
+void SkipReader::load_next(int level) {
+  Entry &entry = next[level];
+  if (ins[level] == ends[level]) {
+    entry.docid = PostingsIterator::NoMoreDocs;
+    return;
+  }
+  const Entry &base = previous[level];
+  const uint8_t *&in = ins[level];
+  entries_read++;
+  entry.docid = base.docid + read_vint(in);
+  static_assert(SkipMultiplier == 8, "entries of a level are 8^level blocks");
+  // only the last block may be partial
+  entry.docs =
+      std::min(base.docs + (PostingsBlockSize << (3 * level)), doc_freq);
+  entry.doc_offset = base.doc_offset + read_vint(in);
+  entry.positions = base.positions + read_vint(in);
+  entry.pos_offset = base.pos_offset + read_vint(in);
+  if (level > 0) {
+    for (int below = level - 1; below >= 0; --below) {
+      next_children[level][below] = read_vint(in);
+    }
+  } else {
+    entry.impact.max_freq = (uint32_t)read_vint(in);
+    entry.impact.min_norm = *in++;
+  }
+}
+
+const SkipReader::Entry &SkipReader::skip_to(docid_t target) {
+  // climb while the next entry of the level above is behind the target too
+  int level = 0;
+  while (level + 1 < level_count && next[level + 1].docid < target) {
+    level++;
+  }
+  for (;;) {
+    while (next[level].docid < target) {
+      last = previous[level] = next[level];
+      std::copy_n(next_children[level], level, previous_children[level]);
+      load_next(level);
+    }
+    if (level == 0) {
+      return last;
+    }
+    level--;
+    // the level above passed this one, which resumes after the same entry;
+    // the levels further down follow it in turn, whether or not it moves
+    if (previous[level + 1].docs > previous[level].docs) {
+      ins[level] = starts[level] + previous_children[level + 1][level];
+      previous[level] = previous[level + 1];
+      std::copy_n(previous_children[level + 1], level,
+                  previous_children[level]);
+      load_next(level);
+    }
+  }
+}
+
+/*
+ * PostingsIterator constructor
+ */
+PostingsIterator::PostingsIterator(const uint8_t *docs,
+                                   const uint8_t *positions,
+                                   const TermInfo &info)
+    : docs(docs), positions(positions), skip_data(nullptr),
+      skip_loaded(false), doc_freq(info.doc_freq),
+      total_term_freq(info.total_term_freq), docs_left(info.doc_freq),
+      positions_left(info.total_term_freq),
+      buffered(0), index(0), block_base(0), current(NoMoreDocs),
+      positions_buffered(0), position_index(0), position_upto(0),
+      positions_to_skip(0) {
+  if (doc_freq > PostingsBlockSize) {
+    uint64_t skip_length = read_vint(this->docs);
+    skip_data = this->docs;
+    this->docs += skip_length;
+  }
+  docs_start = this->docs;
+  positions_start = positions;
+}
+
+void PostingsIterator::refill_docs() {
+  for (std::size_t i = position_upto; i < buffered; ++i) {
+    positions_to_skip += freq_buffer[i];
+  }
+  position_upto = 0;
+  if (buffered > 0) {
+    block_base += doc_buffer[buffered - 1];
+  }
+  if (docs_left >= PostingsBlockSize) {
+    docs = pfor_decode(docs, doc_buffer);
+    docs = pfor_decode(docs, freq_buffer);
+    prefix_sum(doc_buffer, PostingsBlockSize, 0);
+    buffered = PostingsBlockSize;
+  } else {
+    uint32_t docid = 0;
+    for (std::size_t i = 0; i < docs_left; ++i) {
+      docid += (uint32_t)read_vint(docs);
+      doc_buffer[i] = docid;
+      freq_buffer[i] = (uint32_t)read_vint(docs);
+    }
+    buffered = docs_left;
+  }
+  docs_left -= buffered;
+  index = 0;
+}
+
+docid_t PostingsIterator::next_doc() {
+  if (index == buffered) {
+    if (docs_left == 0) {
+      index = buffered = position_upto = 0;
+      current = NoMoreDocs;
+      return current;
+    }
+    refill_docs();
+  }
+  current = block_base + doc_buffer[index++];
+  return current;
+}
+
+/*
+ * Decode blocks until the last doc of one reaches target, then gallop from
+ * the current doc: probe 1, 2, 4... entries ahead and binary search the last
+ * gap, so advancing a few docs costs a few comparisons.
+ */
+docid_t PostingsIterator::advance(docid_t target) {
+  if (index > 0 && current >= target) {
+    return current;
+  }
+  if (index < buffered && block_base + doc_buffer[index] >= target) {
+    // dense lists: the next doc is usually it
+    current = block_base + doc_buffer[index++];
+    return current;
+  }
+  if (skip_data &&
+      (index == buffered || block_base + doc_buffer[buffered - 1] < target)) {
+    load_skip_data();
+    const SkipReader::Entry &entry = skip_reader.skip_to(target);
+    // entry may be further than target after a shallow_advance()
+    if (entry.docs > doc_freq - docs_left && entry.docid < target) {
+      jump(entry);
+    }
+  }
+  while (index == buffered || block_base + doc_buffer[buffered - 1] < target) {
+    if (docs_left == 0) {
+      index = buffered = position_upto = 0;
+      current = NoMoreDocs;
+      return current;
+    }
+    refill_docs();
+  }
+  std::size_t low = index;
+  std::size_t high = index;
+  for (std::size_t step = 1; block_base + doc_buffer[high] < target;
+       step *= 2) {
+    low = high + 1;
+    high = std::min(high + step, buffered - 1);
+  }
+  index = std::lower_bound(doc_buffer + low, doc_buffer + high + 1, target,
+                           [&](uint32_t docid, docid_t target) {
+                             return block_base + docid < target;
+                           }) -
+          doc_buffer;
+  current = block_base + doc_buffer[index++];
+  return current;
+}
+
+void PostingsIterator::load_skip_data() {
+  if (!skip_loaded) {
+    skip_reader.reset(skip_data, doc_freq);
+    skip_loaded = true;
+  }
+}
+
+docid_t PostingsIterator::shallow_advance(docid_t target, Impact &impact) {
+  load_skip_data();
+  skip_reader.skip_to(target);
+  const SkipReader::Entry &block = skip_reader.next_block();
+  impact = block.impact;
+  return block.docid;
+}
+
+const Impact &PostingsIterator::get_max_impact() {
+  load_skip_data();
+  return skip_reader.get_max_impact();
+}
+
+/*
+ * Continue after the docs of a skip entry without decoding them. Their
+ * positions are dropped: reading restarts at the positions block holding
+ * the next one.
+ */
+void PostingsIterator::jump(const SkipReader::Entry &entry) {
+  docs = docs_start + entry.doc_offset;
+  docs_left = doc_freq - entry.docs;
+  block_base = entry.docid;
+  buffered = index = position_upto = 0;
+  uint64_t block_start =
+      entry.positions - entry.positions % PostingsBlockSize;
+  positions = positions_start + entry.pos_offset;
+  positions_left = total_term_freq - block_start;
+  positions_buffered = position_index = 0;
+  positions_to_skip = entry.positions - block_start;
+}
+
+void PostingsIterator::refill_positions() {
+  if (positions_left >= PostingsBlockSize) {
+    positions = pfor_decode(positions, position_buffer);
+    positions_buffered = PostingsBlockSize;
+  } else {
+    for (std::size_t i = 0; i < positions_left; ++i) {
+      position_buffer[i] = (uint32_t)read_vint(positions);
+    }
+    positions_buffered = positions_left;
+  }
+  positions_left -= positions_buffered;
+  position_index = 0;
+}
+
+/*
+ * Drop count position deltas. Full blocks in between are stepped over from
+ * their headers without unpacking them.
+ */
+void PostingsIterator::skip_positions(uint64_t count) {
+  uint64_t available = positions_buffered - position_index;
+  if (count <= available) {
+    position_index += count;
+    return;
+  }
+  count -= available;
+  position_index = positions_buffered;
+  while (count >= PostingsBlockSize) {
+    positions = pfor_skip(positions);
+    positions_left -= PostingsBlockSize;
+    count -= PostingsBlockSize;
+  }
+  if (count > 0) {
+    refill_positions();
+    position_index = count;
+  }
+}
+
+const std::vector<term_id_t> &PostingsIterator::get_positions() {
+  if (position_upto < index) {
+    for (std::size_t i = position_upto; i + 1 < index; ++i) {
+      positions_to_skip += freq_buffer[i];
+    }
+    skip_positions(positions_to_skip);
+    positions_to_skip = 0;
+    current_positions.clear();
+    term_id_t position = 0;
+    for (uint32_t i = freq(); i > 0; --i) {
+      if (position_index == positions_buffered) {
+        refill_positions();
+      }
+      position += position_buffer[position_index++];
+      current_positions.push_back(position);
+    }
+    position_upto = index;
+  }
+  return current_positions;
+}
+
+// maps filename and checks that it starts with magic
+static std::unique_ptr<MappedFile> map_with_magic(Directory *directory,
+                                                const std::string &filename,
+                                                const char *magic) {
+  auto file = directory->map_file(filename);
+  if (file->size() < 4 + FooterLength ||
+      std::memcmp(file->data(), magic, 4) != 0) {
+    throw std::runtime_error("Not a postings file: " + filename);
+  }
+  return file;
+}
+
+/*
+ * FieldReader constructor
+ */
+FieldReader::FieldReader(Directory *directory, const std::string &prefix)
+    : prefix(prefix), terms_file(directory->map_file(prefix + ".tim")),
+      docs_file(map_with_magic(directory, prefix + ".doc",
+                             BinaryCodec::DocsMagic)),
+      positions_file(map_with_magic(directory, prefix + ".pos",
+                                  BinaryCodec::PositionsMagic)),
+      norms_file(map_with_magic(directory, prefix + ".nrm",
+                              BinaryCodec::NormsMagic)),
+      index_file(directory->map_file(prefix + ".tip")) {
+  const uint8_t *in = (const uint8_t *)norms_file->data() + 4;
+  doc_count = read_vint(in);
+  sum_total_term_freq = read_vint(in);
+  first_docid = read_vint(in);
+  docid_span = read_vint(in);
+  norms = in;
+}
+/*
+ * FieldReader destructor
+ */
+FieldReader::~FieldReader() = default;
+
+// the bytes of a file before its footer
+static std::string_view without_footer(const MappedFile &file) {
+  return std::string_view(file.data(),
+                          file.size() - std::min(file.size(), FooterLength));
+}
+
+const TermsReader &FieldReader::get_terms() const {
+  std::call_once(terms_loaded, [this] {
+    // the leaders are copied out, the index file is not kept mapped; it is
+    // read whole anyway, so its checksum is checked on the way
+    check_footer(prefix + ".tip", index_file->data(), index_file->size());
+    terms = std::make_unique<TermsReader>(without_footer(*terms_file),
+                                          without_footer(*index_file));
+    index_file.reset();
+  });
+  return *terms;
+}
+
+void FieldReader::check_integrity() const {
+  get_terms();
+  for (const auto &[extension, file] :
+       {std::pair<const char *, const MappedFile *>{"tim", terms_file.get()},
+        {"doc", docs_file.get()},
+        {"pos", positions_file.get()},
+        {"nrm", norms_file.get()}}) {
+    check_footer(prefix + "." + extension, file->data(), file->size());
+  }
+}
+
+Impact FieldReader::max_impact(const TermInfo &info) const {
+  PostingsIterator iterator = postings(info);
+  if (iterator.has_skip_data()) {
+    return iterator.get_max_impact();
+  }
+  Impact impact;
+  for (docid_t doc = iterator.next_doc(); doc != PostingsIterator::NoMoreDocs;
+       doc = iterator.next_doc()) {
+    impact.add(iterator.freq(), norm(doc));
+  }
+  return impact;
+}
+
+PostingsIterator FieldReader::postings(const TermInfo &info) const {
+  return PostingsIterator(
+      (const uint8_t *)docs_file->data() + info.doc_offset,
+      (const uint8_t *)positions_file->data() + info.pos_offset, info);
+}
@@ -0,0 +1,294 @@
+// segment file formats
+#pragma once
+
+#include "bitpacking.h"
+#include "index.h"
+#include "terms.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * TextCodec writes one human readable file per field,
+ * _<segment>.<field>.txt, with one line per term:
+ *   term: d0[1,2,3] d4[7]
+ */
+class TextCodec : public Codec {
+public:
+  TextCodec();
+  ~TextCodec() override;
+  std::vector<std::string> encode_term_dictionarie(
+      Directory *directory, const std::string &segment_name,
+      std::unordered_map<std::string, TermDictionary> &term_dictionaries)
+      override;
+  // text segments are for reading by eye, this throws
+  std::unique_ptr<FieldReader>
+  decode_term_dictionary(Directory *directory, const std::string &segment_name,
+                         const std::string &field_name) override;
+  // nor can they be merged
+  std::vector<std::string>
+  merge_segments(Directory *directory, const std::string &segment_name,
+                 const std::vector<SegmentInfos> &segments) override;
+};
+
+/*
+ * BinaryCodec writes five files per field. Every file starts with a 4 byte
+ * magic and ends with a checksum footer (see store.h); numbers are VInts
+ * (see pfor.h).
+ *
+ * _<segment>.<field>.tim and .tip, the term dictionary: terms sorted by
+ *   their bytes in front coded blocks, and the index of block leaders (see
+ *   TermsWriter in terms.h). Every term records doc_freq, total_term_freq
+ *   and where its postings start in .doc and .pos.
+ *
+ * _<segment>.<field>.doc: "TLDC", then per term doc_freq entries of
+ *   (docid delta, freq), the first delta from 0:
+ *   each full run of 128 entries is a PFOR block of docid deltas followed
+ *   by a PFOR block of freqs; the rest are VInt pairs.
+ *   Terms with more than 128 docs are preceded by skip data (see
+ *   SkipReader): its length in bytes, then the data.
+ *
+ * _<segment>.<field>.pos: "TLPS", then per term total_term_freq position
+ *   deltas, from 0 in every doc: PFOR blocks of 128, then the rest as VInts.
+ *
+ * _<segment>.<field>.nrm, the field's statistics and norms: "TLNM",
+ *   doc_count (docs with the field), sum_total_term_freq (terms in all of
+ *   them), first_docid, docid_span, then docid_span bytes, the length of
+ *   every doc from first_docid on as encode_norm() (0 without the field).
+ *
+ * merge_segments() writes the same files from those of other segments,
+ * without going back to a TermDictionary.
+ */
+class BinaryCodec : public Codec {
+public:
+  static constexpr const char *DocsMagic = "TLDC";
+  static constexpr const char *PositionsMagic = "TLPS";
+  static constexpr const char *NormsMagic = "TLNM";
+
+  BinaryCodec();
+  ~BinaryCodec() override;
+  std::vector<std::string> encode_term_dictionarie(
+      Directory *directory, const std::string &segment_name,
+      std::unordered_map<std::string, TermDictionary> &term_dictionaries)
+      override;
+  std::unique_ptr<FieldReader>
+  decode_term_dictionary(Directory *directory, const std::string &segment_name,
+                         const std::string &field_name) override;
+  std::vector<std::string>
+  merge_segments(Directory *directory, const std::string &segment_name,
+                 const std::vector<SegmentInfos> &segments) override;
+};
+
+/*
+ * Norms: a field's length in a doc, in a byte. Lengths below 24 are exact,
+ * longer ones keep their 4 most significant bits (as Lucene's SmallFloat),
+ * so the encoding is monotonic and a decoded length is at most 1/8 short.
+ */
+uint8_t encode_norm(uint64_t length);
+uint64_t decode_norm(uint8_t norm);
+
+/*
+ * What bounds the score of a term in a run of docs: its highest freq and
+ * the shortest norm among them. A score grows with the freq and shrinks
+ * with the length, so no doc scores above (max_freq, min_norm).
+ */
+struct Impact {
+  uint32_t max_freq = 0;
+  uint8_t min_norm = 255;
+  void add(uint32_t freq, uint8_t norm);
+};
+
+/*
+ * SkipReader finds, in the skip data of a term's postings, the last block
+ * boundary before a target doc, so that advance() can jump there without
+ * decoding the blocks in between, and the impact of the block holding it.
+ *
+ * Level 0 has an entry per block of docs, describing the state after it:
+ *   docid       last doc of the block
+ *   doc_offset  start of the next block, from the first block
+ *   positions   positions of the docs up to there
+ *   pos_offset  start of the positions block holding the next position,
+ *               from the term's first one
+ *   max_freq, min_norm, the Impact of the block's docs
+ * Level n + 1 repeats every SkipMultiplier-th entry of level n and adds
+ * its children: for every level below, from n down to 0, the offset in that
+ * level right after that same entry. The data is:
+ *   level_count, max_freq, min_norm (the Impact of the whole term), then
+ *   per level from the top: byte_length, entries
+ *   entry: docid, doc_offset, positions, pos_offset as deltas from the
+ *   previous entry of the level, then on level 0 max_freq and min_norm,
+ *   on level n > 0 its n children
+ * A lookup walks the top level while it is behind the target and goes down
+ * one level at each entry that is not. A level the one above has passed
+ * first resumes after the same entry, found from its children, so every
+ * level reads at most SkipMultiplier entries and a lookup O(log n).
+ */
+class SkipReader {
+public:
+  static constexpr int MaxSkipLevels = 10;
+  static constexpr uint64_t SkipMultiplier = 8;
+  struct Entry {
+    docid_t docid = 0;
+    uint64_t docs = 0; // docs up to here
+    uint64_t doc_offset = 0;
+    uint64_t positions = 0;
+    uint64_t pos_offset = 0;
+    Impact impact; // of the block, level 0 only
+  };
+
+private:
+  int level_count;
+  uint64_t doc_freq;
+  Impact max_impact;
+  const uint8_t *starts[MaxSkipLevels];
+  const uint8_t *ends[MaxSkipLevels];
+  const uint8_t *ins[MaxSkipLevels]; // next entry per level
+  Entry previous[MaxSkipLevels];     // last entry read per level
+  Entry next[MaxSkipLevels];         // peeked, docid NoMoreDocs at the end
+  Entry last;                        // last entry skipped over
+  // children of previous and next per level, by level below
+  uint64_t previous_children[MaxSkipLevels][MaxSkipLevels];
+  uint64_t next_children[MaxSkipLevels][MaxSkipLevels];
+  uint64_t entries_read;
+  void load_next(int level);
+
+public:
+  SkipReader();
+  // starts at the beginning of the skip data at data
+  void reset(const uint8_t *data, uint64_t doc_freq);
+  // the last entry with docid < target: the one of the previous call if
+  // none is further, or an empty Entry
+  const Entry &skip_to(docid_t target);
+  // the entry of the block after the last one skipped, docid NoMoreDocs
+  // past the last block
+  const Entry &next_block() const { return next[0]; }
+  const Impact &get_max_impact() const { return max_impact; }
+  // entries decoded since reset(), over all levels
+  uint64_t get_entries_read() const { return entries_read; }
+};
+
+/*
+ * PostingsIterator walks the postings of one term of a BinaryCodec field
+ * in docid order, straight from the mapped .doc and .pos files. Docs and
+ * freqs are decoded a block at a time; positions only when get_positions()
+ * is called, skipping whole blocks of those of the docs passed over.
+ * advance() jumps over blocks with the skip data, read only once it is
+ * needed. Docids of a segment are assumed to span less than 2^32, as
+ * blocks decode to 32 bits.
+ */
+class PostingsIterator {
+  const uint8_t *docs;      // next undecoded entry in .doc
+  const uint8_t *positions; // next undecoded delta in .pos
+  const uint8_t *docs_start;
+  const uint8_t *positions_start;
+  const uint8_t *skip_data; // nullptr if the term has none
+  bool skip_loaded;
+  SkipReader skip_reader;
+  uint64_t doc_freq;
+  uint64_t total_term_freq;
+  uint64_t docs_left;      // entries not decoded yet
+  uint64_t positions_left; // position deltas not decoded yet
+  // current block of docs: docids relative to block_base, and freqs
+  uint32_t doc_buffer[PostingsBlockSize];
+  uint32_t freq_buffer[PostingsBlockSize];
+  std::size_t buffered;
+  std::size_t index; // of the entry after the current one
+  docid_t block_base;
+  docid_t current;
+  // current block of position deltas
+  uint32_t position_buffer[PostingsBlockSize];
+  std::size_t positions_buffered;
+  std::size_t position_index;
+  std::size_t position_upto; // first buffered doc whose positions are
+                             // neither read nor in positions_to_skip
+  uint64_t positions_to_skip; // of the docs passed over
+  std::vector<term_id_t> current_positions;
+  void refill_docs();
+  void refill_positions();
+  void skip_positions(uint64_t count);
+  void load_skip_data();
+  // moves to the block after a skip entry
+  void jump(const SkipReader::Entry &entry);
+
+public:
+  static constexpr docid_t NoMoreDocs = ~(docid_t)0;
+
+  PostingsIterator(const uint8_t *docs, const uint8_t *positions,
+                   const TermInfo &info);
+  // moves to the next doc and returns it, NoMoreDocs after the last one
+  docid_t next_doc();
+  // moves to the first doc >= target and returns it; stays on the current
+  // doc if it is already there
+  docid_t advance(docid_t target);
+  docid_t docid() const { return current; }
+  uint32_t freq() const { return freq_buffer[index - 1]; }
+  uint64_t get_doc_freq() const { return doc_freq; }
+  // positions of the term in the current doc
+  const std::vector<term_id_t> &get_positions();
+  // terms of up to one block have no skip data, and so no block impacts
+  bool has_skip_data() const { return skip_data != nullptr; }
+  /*
+   * Moves the skip data, but not the iterator, to the block holding the
+   * first doc >= target and returns that block's last doc and impact, or
+   * NoMoreDocs past the last block. Needs skip data; target must not go
+   * below a previous advance() or shallow_advance() target.
+   */
+  docid_t shallow_advance(docid_t target, Impact &impact);
+  // the Impact of all the term's docs, from the skip data
+  const Impact &get_max_impact();
+  // skip entries decoded so far, to check what a skip costs
+  uint64_t get_skip_entries_read() const {
+    return skip_loaded ? skip_reader.get_entries_read() : 0;
+  }
+};
+
+/*
+ * FieldReader is the read side of one field of a BinaryCodec segment. It
+ * maps its five files and keeps only the terms index (.tip) in memory, read
+ * by the first get_terms(): opening costs a few system calls and the first
+ * lookup one pass over the block leaders, whatever the number of postings.
+ * Checksums are verified only where a file is read whole anyway: .tip by
+ * that first lookup, all of them by check_integrity() before a merge.
+ * A FieldReader is otherwise immutable: threads share it and each walks its
+ * own PostingsIterators.
+ */
+class FieldReader {
+  std::string prefix;
+  std::unique_ptr<MappedFile> terms_file;
+  std::unique_ptr<MappedFile> docs_file;
+  std::unique_ptr<MappedFile> positions_file;
+  std::unique_ptr<MappedFile> norms_file;
+  // until get_terms() has read it
+  mutable std::unique_ptr<MappedFile> index_file;
+  mutable std::once_flag terms_loaded;
+  mutable std::unique_ptr<TermsReader> terms;
+  uint64_t doc_count;
+  uint64_t sum_total_term_freq;
+  docid_t first_docid;
+  uint64_t docid_span;
+  const uint8_t *norms;
+
+public:
+  // prefix is "<segment>.<field>"
+  FieldReader(Directory *directory, const std::string &prefix);
+  ~FieldReader();
+  const TermsReader &get_terms() const;
+  // reads every file whole and throws unless their checksums match
+  void check_integrity() const;
+  PostingsIterator postings(const TermInfo &info) const;
+  uint64_t get_doc_count() const { return doc_count; }
+  uint64_t get_sum_total_term_freq() const { return sum_total_term_freq; }
+  // the docs norm() has a byte for, the others have 0
+  docid_t get_first_docid() const { return first_docid; }
+  uint64_t get_docid_span() const { return docid_span; }
+  // encoded length of the field in docid, 0 if the doc does not have it
+  uint8_t norm(docid_t docid) const {
+    return docid - first_docid < docid_span ? norms[docid - first_docid] : 0;
+  }
+  // the Impact of all the docs of a term
+  Impact max_impact(const TermInfo &info) const;
+};
@@ -2,70 +2,181 @@
 #include "html_parser.h"
 // debug
 #include <cassert>
-#include <cctype>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SCAN 1
+#endif
+
 namespace {
 
-// Tag name can contain: a-z, A-Z, 0-9, '!' (for <!--, <!doctype), '-' (for !--)
+// Byte classes used by the scanner.
+enum : uint8_t {
+    kSpace = 1,    // isspace() in the C locale
+    kTagOpen = 2,  // '<'
+    kTagChar = 4,  // a-z, A-Z, 0-9, '!' (for <!--, <!doctype)
+};
+
+constexpr uint8_t Classify(unsigned char c) {
+    uint8_t cls = 0;
+    if (c == ' ' || (c >= '\t' && c <= '\r'))
+        cls |= kSpace;
+    if (c == '<')
+        cls |= kTagOpen;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '!')
+        cls |= kTagChar;
+    return cls;
+}
+
+struct CharClassTable {
+    uint8_t cls[256];
+    constexpr CharClassTable() : cls() {
+        for (int c = 0; c < 256; ++c)
+            cls[c] = Classify(static_cast<unsigned char>(c));
+    }
+};
+
+constexpr CharClassTable CharClass;
+
+inline bool Is(char c, uint8_t cls) {
+    return CharClass.cls[static_cast<unsigned char>(c)] & cls;
+}
+
+// Tag name can contain: a-z, A-Z, 0-9, '!' (for <!--, <!doctype)
 inline bool IsTagChar(char c) {
-    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '!';
+    return Is(c, kTagChar);
+}
+
+inline bool IsSpace(char c) {
+    return Is(c, kSpace);
 }
 
 inline char ToLower(char c) {
     return (c >= 'A' && c <= 'Z') ? (c + ('a' - 'A')) : c;
 }
 
+inline const char *Find(const char *ptr, const char *end, char c) {
+    if (ptr >= end)
+        return end;
+    auto found = static_cast<const char *>(memchr(ptr, c, end - ptr));
+    return found ? found : end;
+}
+
+inline const char *SkipSpace(const char *ptr, const char *end) {
+    for (; ptr < end && IsSpace(*ptr); ++ptr) {
+    }
+    return ptr;
+}
+
+#ifdef HAVE_X86_SCAN
+// Returns the first whitespace or '<' of [ptr, end), scanning 32 bytes at a
+// time, or the start of the last partial chunk if there is none before it.
+// Built for AVX2 whatever -march says and only called if the CPU has it, see
+// FindSpaceOrTagOpen().
+__attribute__((target("avx2"))) const char *FindSpaceOrTagOpenAvx2(const char *ptr,
+                                                                     const char *end) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i open = _mm256_set1_epi8('<');
+    const __m256i below_tab = _mm256_set1_epi8('\t' - 1);
+    const __m256i above_cr = _mm256_set1_epi8('\r' + 1);
+    for (; end - ptr >= 32; ptr += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr));
+        // Signed compares: bytes >= 0x80 are negative and never in [\t, \r].
+        __m256i ctrl = _mm256_and_si256(_mm256_cmpgt_epi8(v, below_tab),
+                                        _mm256_cmpgt_epi8(above_cr, v));
+        __m256i hit = _mm256_or_si256(
+            ctrl, _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, open)));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+    return ptr;
+}
+
+bool DetectAvx2() {
+    // runs from a static initializer, possibly before libgcc's own
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+const bool HasAvx2 = DetectAvx2();
+#endif
+
+#if defined(__SSE2__)
+// Bit i is set if ptr[i] is whitespace or '<', for 16 bytes.
+inline uint32_t SpaceOrTagOpenMask(const char *ptr) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i open = _mm_set1_epi8('<');
+    const __m128i below_tab = _mm_set1_epi8('\t' - 1);
+    const __m128i above_cr = _mm_set1_epi8('\r' + 1);
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+    // Signed compares: bytes >= 0x80 are negative and never in [\t, \r].
+    __m128i ctrl = _mm_and_si128(_mm_cmpgt_epi8(v, below_tab), _mm_cmplt_epi8(v, above_cr));
+    __m128i hit =
+        _mm_or_si128(ctrl, _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, open)));
+    return static_cast<uint32_t>(_mm_movemask_epi8(hit));
+}
+#endif
+
+// Returns the first byte in [ptr, end) that is whitespace or '<', or end.
+// Most words end within 16 bytes, which one SSE2 compare settles inline; a
+// longer run (a URL, a base64 blob) goes on 32 bytes at a time with AVX2 if
+// the CPU has it, then 16 at a time.
+inline const char *FindSpaceOrTagOpen(const char *ptr, const char *end) {
+#if defined(__SSE2__)
+    if (end - ptr >= 16) {
+        uint32_t mask = SpaceOrTagOpenMask(ptr);
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+        ptr += 16;
+#ifdef HAVE_X86_SCAN
+        if (HasAvx2)
+            ptr = FindSpaceOrTagOpenAvx2(ptr, end);
+#endif
+    }
+    for (; end - ptr >= 16; ptr += 16) {
+        uint32_t mask = SpaceOrTagOpenMask(ptr);
+        if (mask)
+            return ptr + __builtin_ctz(mask);
+    }
+#endif
+    for (; ptr < end && !Is(*ptr, kSpace | kTagOpen); ++ptr) {
+    }
+    return ptr;
+}
+
 }  // namespace
 
-void HtmlParser::AddWord(const std::string &word) {
-    // TODO: implement
+void HtmlParser::AddWord(const char *start, const char *end, Link *anchor) {
+    size_t length = end - start;
+    if (length >= 3 && end[-1] == '>' && end[-2] == '-' && end[-3] == '-') {
+        return;
+    }
+    std::string_view word(start, length);
+    if (anchor) {
+        anchor->anchorText.push_back(word);
+    }
     if (in_title_) {
         titleWords.push_back(word);
     } else {
         words.push_back(word);
     }
 }
-bool IsWordBreak(const char *&ptr, const char *end, int &offset) {
-    offset = 1;
-    uint8_t utf8_0, utf8_1, utf8_2;
-    // print_utf8_bytes(ptr, 1);
-    utf8_0 = static_cast<uint8_t>(static_cast<unsigned char>(ptr[0]));
-    if (std::isspace(utf8_0)) {
-        return true;
-    }
-    if (ptr + 1 < end) {
-        utf8_1 = static_cast<uint8_t>(static_cast<unsigned char>(ptr[1]));
-        // if (utf8_0 == 0xC2 && utf8_1 == 0xA0) {
-        //   offset = 2;
-        //   return true;
-        // }
-    }
-    if (ptr + 2 < end) {
-        // utf8_2 = static_cast<uint8_t>(static_cast<unsigned char>(ptr[2]));
-        // if (utf8_0 == 0xE3 && utf8_1 == 0x80 && utf8_2 == 0x80 ||
-        //     utf8_0 == 0xE2 && utf8_1 == 0x80 && utf8_2 == 0xAF) {
-        //   offset = 3;
-        //   return true;
-        // }
-    }
-    return false;
-}
-std::string HtmlParser::ExtractAttribute(const char *start, const char *end,
-                                         const std::string &attr_name) {
+
+std::string_view HtmlParser::ExtractAttribute(const char *start, const char *end,
+                                              std::string_view attr_name) {
     // walk to the white spsace
 
     // todo: deal with multiple attributes
-    const char *left_ptr = start;
+    const char *left_ptr = SkipSpace(start, end);
     const char *right_ptr = start;
-    int left_offset = 1;
-    for (; left_ptr < end && IsWordBreak(left_ptr, end, left_offset); left_ptr += left_offset) {
-    }
     if (left_ptr == end) {
         return "";
     }
-    for (; right_ptr < end && *right_ptr != '=' && right_ptr != end; right_ptr++) {
+    for (; right_ptr < end && *right_ptr != '='; right_ptr++) {
     }
     if (right_ptr == end) {
         return "";
@@ -74,12 +185,11 @@ std::string HtmlParser::ExtractAttribute(const char *start, const char *end,
     if (left_ptr >= right_ptr) {
         return "";
     }
-    std::string attr_name_ = std::string(left_ptr, right_ptr - left_ptr);
+    std::string_view attr_name_(left_ptr, right_ptr - left_ptr);
     // std::cout << "attr_name_: " << attr_name_ << std::endl;
     if (attr_name_ != attr_name) {
         // get to next space
-        for (; left_ptr < end && !IsWordBreak(left_ptr, end, left_offset) && left_ptr != end;
-             left_ptr += left_offset) {
+        for (; left_ptr < end && !IsSpace(*left_ptr); left_ptr++) {
         }
         if (left_ptr == end) {
             return "";
@@ -88,257 +198,409 @@ std::string HtmlParser::ExtractAttribute(const char *start, const char *end,
     }
     left_ptr = right_ptr + 2;
     right_ptr = left_ptr;
-    for (; right_ptr < end && *right_ptr != '"' && right_ptr != end; right_ptr++) {
+    for (; right_ptr < end && *right_ptr != '"'; right_ptr++) {
     }
-    if (right_ptr == end) {
+    if (right_ptr >= end) {
         return "";
     }
-    std::string attr_value = std::string(left_ptr, right_ptr - left_ptr);
-    return attr_value;
+    return std::string_view(left_ptr, right_ptr - left_ptr);
 }
 
-void HtmlParser::SkipUntilCloseTag(const char *tag_name, size_t tag_len) {
-    // Minimum closing tag: "</x>" = 4 chars, need at least 3 + tag_len.
-    for (; pos_ + 2 + tag_len < end_; ++pos_) {
+bool HtmlParser::SkipUntilCloseTag() {
+    size_t tag_len = section_tag_.size();
+    for (;;) {
         // Look for '</'
-        if (pos_[0] != '<' || pos_[1] != '/')
+        const char *ptr = Find(pos_, end_, '<');
+        // Minimum closing tag: "</x>" = 4 chars, need at least 3 + tag_len.
+        if (end_ - ptr <= static_cast<ptrdiff_t>(2 + tag_len)) {
+            // Not found, move to end (or wait for the rest of a candidate).
+            pos_ = (final_ || ptr == end_) ? end_ : ptr;
+            return final_ || ptr == end_;
+        }
+        pos_ = ptr + 1;
+        if (ptr[1] != '/')
             continue;
 
-        const char *name_start = pos_ + 2;
+        const char *name_start = ptr + 2;
         const char *name_end = name_start;
         for (; name_end < end_ && IsTagChar(*name_end); ++name_end) {
         }
+        if (name_end == end_ && !final_) {
+            pos_ = ptr;
+            return false;
+        }
 
         // Case-insensitive comparison.
         if (static_cast<size_t>(name_end - name_start) != tag_len)
             continue;
 
-        // TODO: optimize this part, it's too slow
         bool match = true;
         for (size_t i = 0; i < tag_len && match; ++i) {
-            match = (ToLower(name_start[i]) == ToLower(tag_name[i]));
+            match = (ToLower(name_start[i]) == ToLower(section_tag_[i]));
         }
 
         if (match) {
             // Found the closing tag. Skip to '>'.
-            for (pos_ = name_end; pos_ < end_ && *pos_ != '>'; ++pos_) {
-            }
-            if (pos_ < end_)
-                ++pos_;
-            return;
+            pos_ = name_end;
+            pending_action_ = DesiredAction::Discard;
+            state_ = State::TagEnd;
+            return true;
         }
     }
-    pos_ = end_;  // Not found, move to end.
 }
 
-void HtmlParser::SkipComment() {
-    for (; pos_ + 2 < end_; ++pos_) {
-        if (pos_[0] == '-' && pos_[1] == '-' && pos_[2] == '>') {
-            pos_ += 3;  // Skip '-->'
-            return;
+bool HtmlParser::SkipComment() {
+    for (;;) {
+        const char *ptr = Find(pos_, end_, '-');
+        if (end_ - ptr < 3) {
+            // Not found, move to end (or wait for the rest of a candidate).
+            pos_ = (final_ || ptr == end_) ? end_ : ptr;
+            return final_ || ptr == end_;
         }
+        if (ptr[1] == '-' && ptr[2] == '>') {
+            pos_ = ptr + 3;  // Skip '-->'
+            state_ = State::AfterTag;
+            return true;
+        }
+        pos_ = ptr + 1;
     }
-    pos_ = end_;  // Not found, move to end.
 }
 
-void HtmlParser::ProcessTag() {
-    // pos_ points to '<'. Skip it.
-    ordinary_text_ = false;
-    ++pos_;
-    if (pos_ >= end_)
-        return;
-
-    // Check if closing tag.
-    bool is_closing = (*pos_ == '/');
-    if (is_closing)
-        ++pos_;
-
-    // Extract tag name.
-    const char *name_start = pos_;
-    for (; pos_ < end_ && IsTagChar(*pos_); ++pos_) {
+void HtmlParser::SkipTagEnd() {
+    pos_ = Find(pos_, end_, '>');
+    if (pos_ < end_) {
+        ++pos_;  // Skip '>'.
+    } else if (!final_) {
+        return;  // The rest of the tag is in the next chunk.
     }
-    const char *name_end = pos_;
 
-    if (name_start == name_end)
-        return;  // Empty tag name, treat '<' as text.
-    // std::cout << "tag: " << std::string(name_start, name_end - name_start) <<
-    // std::endl; Lookup tag action.
-    auto action = LookupPossibleTag(name_start, name_end);
-    if (action == DesiredAction::OrdinaryText) {
-        ordinary_text_ = true;
-        pos_ = is_closing ? name_start - 2 : name_start - 1;
-        return;
+    state_ = State::AfterTag;
+    if (pending_action_ == DesiredAction::Anchor) {
+        if (pending_closing_ && !anchor_stack_.empty()) {
+            anchor_stack_.pop_back();
+        }
+    } else if (pending_action_ == DesiredAction::DiscardSection) {
+        if (!pending_closing_) {
+            state_ = State::Section;
+        }
+    } else if (pending_action_ == DesiredAction::Title) {
+        in_title_ = !pending_closing_;
     }
+}
 
-    // Find end of tag '>'.
-    const char *tag_content_start = pos_;
-    const char *tag_end = pos_;
-    for (; tag_end < end_ && *tag_end != '>'; ++tag_end) {
+bool HtmlParser::ReadTagName(const char *name, const char *&name_end,
+                             DesiredAction &action) const {
+    for (name_end = name; name_end < end_ && IsTagChar(*name_end); ++name_end) {
     }
-    if (action == DesiredAction::Comment) {
-        SkipComment();
-    } else {
-        pos_ = tag_end;
-        if (pos_ < end_)
-            ++pos_;  // Skip '>'.
+    // '<!--' is recognized from the bytes after the name, so "<!" and "<!-"
+    // also need the two bytes that follow.
+    bool short_comment = *name == '!' && name_end - name == 1 && end_ - name < 3;
+    if (!final_ && (name_end == end_ || short_comment)) {
+        return false;
     }
-
-    // Handle based on action (ordered by frequency).
-    if (action == DesiredAction::Discard) {
-        return;
-    } else if (action == DesiredAction::Anchor) {
-        // Anchor Tag -> links
-        if (is_closing) {
-            if (!anchor_stack_.empty()) {
-                // assert that the stack's entries have non empty url
-                anchor_stack_.pop_back();
-                // assert(!anchor_stack_.back()->URL.empty());
-                // std::cout << pos_ << std::endl;
-            }
-        } else {
-            auto href = ExtractAttribute(tag_content_start, tag_end, "href");
-            if (!href.empty()) {
-                links.emplace_back(href);
-                auto &link = links.back();
-                // for (auto link : anchor_stack_) {
-                //   assert(!link->URL.empty());
-                // }
-                // std::cout << "link: " << href << std::endl;
-                anchor_stack_.push_back(&links.back());
-            }
-        }
-    } else if (action == DesiredAction::DiscardSection) {
-        if (!is_closing) {
-            SkipUntilCloseTag(name_start, name_end - name_start);
-        }
-    } else if (action == DesiredAction::Comment) {
-        // std::cout << "commen!" << std::endl;
-        // SkipComment();
-    } else if (action == DesiredAction::Title) {
-        in_title_ = !is_closing;
-    } else if (action == DesiredAction::Base) {
-        if (!is_closing && base.empty())
-            base = ExtractAttribute(tag_content_start, tag_end, "href");
-    } else if (action == DesiredAction::Embed) {
-        if (!is_closing) {
-            auto src = ExtractAttribute(tag_content_start, tag_end, "src");
-            if (!src.empty()) {
-                // If present, it should be added to the links with no anchor text.
-                links.emplace_back(src);
-            }
-        }  // not closing
+    if (name_end == name || short_comment) {
+        action = DesiredAction::OrdinaryText;
     } else {
-        // anomalous tag
+        action = LookupPossibleTag(name, name_end);
     }
+    return true;
 }
 
-bool IsText(const char *start, const char *end) {
-    if (*start != '<') {
+bool HtmlParser::ProcessTag() {
+    // pos_ points to '<'.
+    const char *ptr = pos_ + 1;
+    bool is_closing = ptr < end_ && *ptr == '/';
+    if (is_closing)
+        ++ptr;
+    if (ptr >= end_) {
+        if (!final_)
+            return false;
+        ordinary_text_ = false;
+        pos_ = end_;
+        state_ = State::AfterTag;
         return true;
     }
-    start++;
 
-    bool is_closing = (*start == '/');
-    if (is_closing)
-        ++start;
-    const char *name_end = start;
-    for (; name_end < end && IsTagChar(*name_end); name_end++) {
+    // Extract tag name.
+    const char *name_start = ptr;
+    const char *name_end;
+    DesiredAction action;
+    if (!ReadTagName(name_start, name_end, action))
+        return false;
+
+    ordinary_text_ = false;
+    state_ = State::AfterTag;
+    if (name_start == name_end) {
+        pos_ = name_end;
+        return true;  // Empty tag name, drop the '<' and go on with text.
     }
-    auto action = LookupPossibleTag(start, name_end);
     if (action == DesiredAction::OrdinaryText) {
+        ordinary_text_ = true;
+        return true;  // pos_ stays on '<', which starts a text run.
+    }
+    if (action == DesiredAction::Comment) {
+        pos_ = name_end;
+        state_ = State::Comment;
+        return true;
+    }
+
+    bool needs_attributes = !is_closing && (action == DesiredAction::Anchor ||
+                                            (action == DesiredAction::Base && base.empty()) ||
+                                            action == DesiredAction::Embed);
+    if (!needs_attributes) {
+        // Only the action matters; the rest of the tag can span chunks.
+        pending_action_ = action;
+        pending_closing_ = is_closing;
+        if (action == DesiredAction::DiscardSection)
+            section_tag_.assign(name_start, name_end);
+        pos_ = name_end;
+        state_ = State::TagEnd;
         return true;
     }
-    return false;
-}
 
-void print_utf8_bytes(const char *ptr, size_t len) {
-    for (size_t i = 0; i < len; i++) {
-        // Print each byte in hex
-        std::cout << "0x" << std::hex << std::uppercase
-                  << (static_cast<unsigned int>(static_cast<unsigned char>(ptr[i]))) << " ";
+    // Find end of tag '>'; attributes are read from the whole tag.
+    const char *tag_content_start = name_end;
+    const char *tag_end = Find(name_end, end_, '>');
+    if (tag_end == end_ && !final_) {
+        state_ = State::Tag;
+        return false;
     }
-    std::cout << std::dec << "\n";  // reset decimal
+    pos_ = tag_end;
+    if (pos_ < end_)
+        ++pos_;  // Skip '>'.
+
+    if (action == DesiredAction::Anchor) {
+        // Anchor Tag -> links
+        auto href = ExtractAttribute(tag_content_start, tag_end, "href");
+        if (!href.empty()) {
+            AddLink(href);
+            anchor_stack_.push_back(links.size() - 1);
+        }
+    } else if (action == DesiredAction::Base) {
+        base = ExtractAttribute(tag_content_start, tag_end, "href");
+    } else if (action == DesiredAction::Embed) {
+        auto src = ExtractAttribute(tag_content_start, tag_end, "src");
+        if (!src.empty()) {
+            // If present, it should be added to the links with no anchor text.
+            AddLink(src);
+        }
+    }
+    return true;
+}
+
+int HtmlParser::StartsTag(const char *ptr) const {
+    const char *name_start = ptr + 1;
+    if (name_start < end_ && *name_start == '/')
+        ++name_start;
+    if (name_start >= end_)
+        return final_ ? 0 : -1;
+    const char *name_end;
+    DesiredAction action;
+    if (!ReadTagName(name_start, name_end, action))
+        return -1;
+    return action != DesiredAction::OrdinaryText;
 }
 
 /*
  * SPEC
- * Process the tag at the current position and add the words to the appropriate
- * vector. If the tag is a title tag, add the words to the titleWords vector. If
- * the tag is not a title tag, add the words to the words vector. If the anchor
- * stack is not empty, add the words to the anchor text of the current link.
+ * Add the words of the text run at pos_ to titleWords if inside <title> and
+ * to words otherwise. If the innermost open anchor is the most recent link,
+ * the words are also added to its anchor text. Words are separated by
+ * whitespace; '<' that does not open a recognized tag is ordinary text.
  * ASSUMPTIONS:
- * pos_ points to start of the tag, right_ptr points to end of the tag
+ * pos_ points into the run. On return pos_ points to the '<' of the next
+ * recognized tag (state Tag), to end_, or to the start of a word that the
+ * end of a non-final chunk cut off.
  */
-// void HtmlParserHelper(const char* right_ptr) {
-//   ProcessTag();
-//   if (in_title_) {
-//     titleWords.push_back(std::string(pos_, right_ptr - pos_));
-//     in_title_ = false;
-//   } else {
-//   }
-// }
-
-bool push_words(std::vector<std::string> &words, const char *start, const char *end) {
-    bool word_found = false;
-    const char *left_ptr = start;
-    const char *right_ptr = start;
-    int right_offset = 1, left_offset = 1;
-    for (; left_ptr < end; left_ptr = right_ptr + right_offset) {
-        for (right_ptr = left_ptr + left_offset;
-             right_ptr < end && !IsWordBreak(right_ptr, end, right_offset);
-             right_ptr += right_offset) {
+bool HtmlParser::ScanText() {
+    Link *anchor = nullptr;
+    if (!anchor_stack_.empty() && links[anchor_stack_.back()].URL == links.back().URL) {
+        anchor = &links.back();
+    }
+    const char *ptr = pos_;
+    while (true) {
+        ptr = SkipSpace(ptr, end_);
+        if (ptr == end_)
+            break;
+        const char *word_start = ptr;
+        int tag = 0;
+        if (*ptr == '<') {
+            tag = StartsTag(ptr);
+            if (tag != 0) {
+                pos_ = ptr;
+                if (tag < 0)
+                    return false;
+                state_ = State::Tag;
+                return true;
+            }
         }
-        for (; left_ptr < right_ptr && IsWordBreak(left_ptr, end, left_offset);
-             left_ptr += left_offset) {
+        for (ptr = FindSpaceOrTagOpen(ptr + 1, end_); ptr < end_ && *ptr == '<';
+             ptr = FindSpaceOrTagOpen(ptr + 1, end_)) {
+            tag = StartsTag(ptr);
+            if (tag != 0)
+                break;
         }
-        if (left_ptr < right_ptr) {
-            word_found = true;
-            std::string word = std::string(left_ptr, right_ptr - left_ptr);
-            if (word[word.length() - 1] == '>' && word[word.length() - 2] == '-' &&
-                word[word.length() - 3] == '-') {
-                continue;
-            }
-            words.push_back(word);
+        if (tag < 0 || (ptr == end_ && !final_)) {
+            pos_ = word_start;
+            return false;
+        }
+        AddWord(word_start, ptr, anchor);
+        if (tag > 0) {
+            pos_ = ptr;
+            state_ = State::Tag;
+            return true;
         }
     }
-    return word_found;
+    pos_ = ptr;
+    return true;
 }
 
-HtmlParser::HtmlParser(const char *buffer, size_t length)
-    : pos_(buffer), end_(buffer + length), in_title_(false) {
-    // TODO: implement main parsing loop
-    // find the next tag
-    const char *right_ptr = pos_;
-    for (pos_ = buffer; pos_ < end_; pos_ = right_ptr) {
-        for (; pos_ < end_ && *pos_ != '<'; pos_++) {
-        }
-        if (pos_ == end_) {
-            return;
-        }
-        ProcessTag();
-        if (*pos_ == '<' && !ordinary_text_) {
-            right_ptr = pos_;
-            continue;
-        }
-        if (pos_ == end_) {
+void HtmlParser::Parse() {
+    while (pos_ < end_) {
+        switch (state_) {
+        case State::SeekTag:
+            // Text before the first '<' is not part of any run.
+            pos_ = Find(pos_, end_, '<');
+            if (pos_ < end_)
+                state_ = State::Tag;
+            break;
+        case State::Tag:
+            if (!ProcessTag())
+                return;
+            break;
+        case State::AfterTag:
+            state_ = (*pos_ == '<' && !ordinary_text_) ? State::Tag : State::Text;
+            break;
+        case State::Text:
+            if (!ScanText())
+                return;
+            break;
+        case State::TagEnd:
+            SkipTagEnd();
+            break;
+        case State::Section:
+            if (!SkipUntilCloseTag())
+                return;
+            break;
+        case State::Comment:
+            if (!SkipComment())
+                return;
             break;
         }
-        // to the next tag
-        // for (right_ptr = pos_ + 1; right_ptr < end_ && *right_ptr != '<';
-        // right_ptr++) {
-        for (right_ptr = pos_ + 1; right_ptr < end_ && IsText(right_ptr, end_); right_ptr++) {
-        }
+    }
+    // A tag left open by the end of the document still takes effect.
+    if (final_ && state_ == State::TagEnd)
+        SkipTagEnd();
+}
 
-        if (in_title_) {
-            // titleWords.push_back(std::string(pos_, right_ptr - pos_));
-            push_words(titleWords, pos_, right_ptr);
-            // in_title_ = false;
-        } else {
-            push_words(words, pos_, right_ptr);
-        }
+HtmlParser::HtmlParser(std::pmr::memory_resource *resource)
+    : words(resource),
+      titleWords(resource),
+      links(resource),
+      base(resource),
+      pos_(nullptr),
+      end_(nullptr),
+      final_(false),
+      state_(State::SeekTag),
+      in_title_(false),
+      ordinary_text_(false),
+      anchor_stack_(resource),
+      pending_action_(DesiredAction::Discard),
+      pending_closing_(false),
+      spare_links_(resource) {}
+
+HtmlParser::HtmlParser(const char *buffer, size_t length, std::pmr::memory_resource *resource)
+    : HtmlParser(resource) {
+    final_ = true;
+    pos_ = buffer;
+    end_ = buffer + length;
+    Parse();
+}
+
+void HtmlParser::AddLink(std::string_view URL) {
+    if (spare_links_.empty()) {
+        links.emplace_back(URL);
+        return;
+    }
+    // Moving keeps the spare's buffers, both use the same resource.
+    links.push_back(std::move(spare_links_.back()));
+    spare_links_.pop_back();
+    Link &link = links.back();
+    link.URL.assign(URL);
+    link.anchorText.clear();
+}
 
-        if (!anchor_stack_.empty() && anchor_stack_.back()->URL == links.back().URL) {
-            bool word_found = push_words(links.back().anchorText, pos_, right_ptr);
+void HtmlParser::reset(const char *buffer, size_t length) {
+    words.clear();
+    titleWords.clear();
+    for (auto &link : links) {
+        spare_links_.push_back(std::move(link));
+    }
+    links.clear();
+    base.clear();
+    anchor_stack_.clear();
+    state_ = State::SeekTag;
+    in_title_ = false;
+    ordinary_text_ = false;
+    pending_action_ = DesiredAction::Discard;
+    pending_closing_ = false;
+    section_tag_.clear();
+    tail_.clear();
+    final_ = true;
+    pos_ = buffer;
+    end_ = buffer + length;
+    Parse();
+}
+
+void HtmlParser::feed(const char *chunk, size_t length) {
+    final_ = false;
+    if (tail_.empty()) {
+        pos_ = chunk;
+        end_ = chunk + length;
+    } else {
+        buffer_.assign(tail_);
+        buffer_.append(chunk, length);
+        pos_ = buffer_.data();
+        end_ = pos_ + buffer_.size();
+    }
+    Parse();
+    tail_.assign(pos_, end_);
+}
+
+void HtmlParser::finish() {
+    final_ = true;
+    buffer_.assign(tail_);
+    tail_.clear();
+    pos_ = buffer_.data();
+    end_ = pos_ + buffer_.size();
+    Parse();
+}
+
+void HtmlParser::clear_tokens() {
+    words.clear();
+    titleWords.clear();
+    for (auto &link : links) {
+        link.anchorText.clear();
+    }
+}
+
+ParserPool::ParserPool(std::pmr::memory_resource *resource) : resource_(resource) {}
+
+ParserPool::~ParserPool() = default;
+
+std::unique_ptr<HtmlParser> ParserPool::acquire() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (!free_.empty()) {
+            auto parser = std::move(free_.back());
+            free_.pop_back();
+            return parser;
         }
     }
+    return std::make_unique<HtmlParser>(resource_);
+}
+
+void ParserPool::release(std::unique_ptr<HtmlParser> parser) {
+    std::lock_guard<std::mutex> guard(lock_);
+    free_.push_back(std::move(parser));
 }
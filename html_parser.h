@@ -21,10 +21,25 @@
 ///   - '<a href="...">' adds a link and collects anchor text.
 ///   - '<base href="...">' sets base (first occurrence only).
 ///   - '<embed src="...">' adds a link without anchor text.
+///
+/// Input is either one contiguous buffer (constructor or reset()) or a
+/// sequence of chunks (feed() then finish()); both produce the same tokens.
+///
+/// Token vectors, links and the base URL are allocated from the
+/// std::pmr::memory_resource given to the constructor (the default heap if
+/// none). A parser built for one buffer typically uses a per-document Arena
+/// that is reset once the document has been indexed. A long-lived parser,
+/// reset() for every document and handed out by a ParserPool, uses a
+/// resource that outlives it instead, so that its vectors keep their
+/// capacity from one document to the next.
 
 #pragma once
 
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 #include "html_tags.h"
 
@@ -32,68 +47,214 @@
 
 class Link {
    public:
-    /// \brief Link URL.
-    std::string URL;
-    /// \brief Anchor text tokens associated with this URL.
-    std::vector<std::string> anchorText;
+    /// \brief Allocator used for URL and anchorText, so that a
+    ///        std::pmr::vector<Link> passes its memory resource on.
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    /// \brief Link URL (a copy, it may outlive the parsed buffer).
+    std::pmr::string URL;
+    /// \brief Anchor text tokens associated with this URL (views into the
+    ///        parsed buffer).
+    std::pmr::vector<std::string_view> anchorText;
 
     /// \brief Constructs a link with the given URL.
-    explicit Link(std::string URL) : URL(URL) {}
+    explicit Link(std::string_view URL, const allocator_type& alloc = {})
+        : URL(URL, alloc), anchorText(alloc) {}
+    Link(const Link& other, const allocator_type& alloc = {})
+        : URL(other.URL, alloc), anchorText(other.anchorText, alloc) {}
+    Link(Link&& other) noexcept = default;
+    Link(Link&& other, const allocator_type& alloc)
+        : URL(std::move(other.URL), alloc), anchorText(std::move(other.anchorText), alloc) {}
+    Link& operator=(const Link&) = default;
+    Link& operator=(Link&&) = default;
 };
 
 /// \brief Parses HTML input and extracts words, title words, and links.
 class HtmlParser {
    public:
-    /// \brief Tokenized body words.
-    std::vector<std::string> words;
-    /// \brief Tokenized title words (from <title>).
-    std::vector<std::string> titleWords;
+    /// \brief Tokenized body words (views into the parsed buffer).
+    std::pmr::vector<std::string_view> words;
+    /// \brief Tokenized title words (from <title>, views into the parsed buffer).
+    std::pmr::vector<std::string_view> titleWords;
     /// \brief Extracted links with anchor text.
-    std::vector<Link> links;
+    std::pmr::vector<Link> links;
     /// \brief Base URL from the first <base href="..."> tag, if any.
-    std::string base;
+    std::pmr::string base;
 
    private:
+    /// \brief Where the parser is between two calls to feed().
+    enum class State {
+        SeekTag,   // before the first '<'; text here is not indexed
+        Tag,       // at the '<' of a tag
+        AfterTag,  // just past a tag, deciding between text and another tag
+        Text,      // inside a text run
+        TagEnd,    // inside a tag whose action is known, looking for '>'
+        Section,   // inside <script>, <style> or <svg>, looking for the close tag
+        Comment,   // inside <!-- ... -->
+    };
+
     /// \brief Current parsing position in the buffer.
     const char* pos_;
 
     /// \brief End of buffer pointer.
     const char* end_;
 
+    /// \brief Whether the bytes up to end_ are the rest of the document. When
+    ///        false, a construct that reaches end_ is left for the next chunk.
+    bool final_;
+
+    /// \brief Current state of the state machine.
+    State state_;
+
     /// \brief Whether currently inside a <title> tag.
     bool in_title_;
 
     /// \brief Whether currently inside ordinary text.
     bool ordinary_text_;
 
-    /// \brief Stack of active <a> tags (supports nesting).
-    std::vector<Link*> anchor_stack_;
+    /// \brief Stack of active <a> tags (supports nesting), as indices into
+    ///        links so that growing links does not invalidate them.
+    std::pmr::vector<size_t> anchor_stack_;
+
+    /// \brief Action of the tag being skipped in State::TagEnd.
+    DesiredAction pending_action_;
+
+    /// \brief Whether the tag being skipped in State::TagEnd is a closing tag.
+    bool pending_closing_;
+
+    /// \brief Name of the section being skipped in State::Section.
+    std::string section_tag_;
+
+    /// \brief Unconsumed bytes at the end of the last chunk (an unfinished tag
+    ///        or word), parsed again in front of the next chunk.
+    std::string tail_;
+
+    /// \brief tail_ followed by the current chunk, when tail_ is not empty.
+    std::string buffer_;
+
+    /// \brief Links of previous documents, kept by reset() so that a new
+    ///        link reuses the memory of their URL and anchor text.
+    std::pmr::vector<Link> spare_links_;
+
+    /// \brief Appends a link to \p URL, recycling a spare one if any.
+    void AddLink(std::string_view URL);
+
+    /// \brief Adds a word to words/titleWords and to the anchor text of
+    ///        \p anchor if it is not null. Words ending in "-->" are dropped.
+    void AddWord(const char* start, const char* end, Link* anchor);
+
+    /// \brief Reads the tag name at \p name and looks up its action.
+    /// \return False if the name may continue past end_ and more input is
+    ///         needed to decide.
+    bool ReadTagName(const char* name, const char*& name_end, DesiredAction& action) const;
 
-    /// \brief Adds a word to words/titleWords and anchor text if applicable.
-    void AddWord(const std::string& word);
+    /// \brief Decides whether the '<' at \p ptr opens a recognized tag.
+    /// \return 1 if it does, 0 if it is text, -1 if more input is needed.
+    int StartsTag(const char* ptr) const;
+
+    /// \brief Tokenizes the text run starting at the current position.
+    /// \details Single pass: bytes are classified through a lookup table and
+    /// the scan jumps to the next whitespace or '<' with SIMD where available.
+    /// Stops at the next recognized tag or at the end of the buffer.
+    /// \return False if a word reaches the end of a non-final chunk.
+    bool ScanText();
 
     /// \brief Extracts an attribute value (e.g., href="...") from tag content.
     /// \param start Tag content start.
     /// \param end Tag content end.
     /// \param attr_name Attribute name to find.
-    /// \return Attribute value or empty string if not found.
-    std::string ExtractAttribute(const char* start, const char* end, const std::string& attr_name);
+    /// \return Attribute value (a view into the tag) or an empty view if not
+    ///         found.
+    std::string_view ExtractAttribute(const char* start, const char* end, std::string_view attr_name);
 
-    /// \brief Skips content until the specified closing tag is found.
-    /// \param tag_name Tag name to match.
-    /// \param tag_len Length of tag name.
-    void SkipUntilCloseTag(const char* tag_name, size_t tag_len);
+    /// \brief Skips content until the closing tag named section_tag_ is found.
+    /// \return False if a candidate closing tag reaches the end of a non-final
+    ///         chunk.
+    bool SkipUntilCloseTag();
 
     /// \brief Skips HTML comment content until "-->" is found.
-    void SkipComment();
+    /// \return False if a candidate "-->" reaches the end of a non-final chunk.
+    bool SkipComment();
+
+    /// \brief Skips to the '>' closing the current tag, then applies
+    ///        pending_action_.
+    void SkipTagEnd();
 
     /// \brief Processes a single HTML tag at the current position.
-    void ProcessTag();
+    /// \return False if the tag is cut off by the end of a non-final chunk.
+    bool ProcessTag();
+
+    /// \brief Runs the state machine over [pos_, end_). Stops early, with
+    ///        pos_ at the first unconsumed byte, when more input is needed.
+    void Parse();
 
    public:
+    /// \brief Creates a parser for incremental input, see feed().
+    /// \param resource Memory for tokens and links; must outlive them.
+    explicit HtmlParser(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
     /// \brief Parses HTML from the provided buffer.
     /// \param buffer Pointer to HTML bytes.
     /// \param length Number of bytes in the buffer.
-    /// \note The buffer must remain valid during construction.
-    HtmlParser(const char* buffer, size_t length);
+    /// \note Words, titleWords and anchorText are std::string_view spans into
+    ///       \p buffer; nothing is copied. The caller owns the buffer and must
+    ///       keep it alive until every token has been consumed, i.e. until the
+    ///       Document built from this parser has been added to the index.
+    /// \param resource Memory for tokens and links; must outlive them.
+    HtmlParser(const char* buffer, size_t length,
+               std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    /// \brief Forgets the previous document and parses \p buffer, as the
+    ///        buffer constructor does.
+    /// \details Words, titleWords, links and the anchor stack are emptied but
+    ///          keep their memory, so a parser reused across documents stops
+    ///          allocating once it has seen a large enough one. Tokens of the
+    ///          previous document are invalidated.
+    void reset(const char* buffer, size_t length);
+
+    /// \brief Parses the next chunk of a document.
+    /// \details Tag, comment, section-skip and anchor state carry over from
+    /// the previous chunk. A tag or word cut by the end of the chunk is kept
+    /// in an internal buffer and finished by the next call, so memory stays
+    /// bounded by the chunk size (plus the longest such construct).
+    /// \note Tokens added by this call point into \p chunk or into the
+    ///       parser's internal buffer. They are valid until the next call to
+    ///       feed() or finish(), so consume them (and clear_tokens()) first.
+    void feed(const char* chunk, size_t length);
+
+    /// \brief Ends the document, flushing whatever the last chunk left open.
+    /// \note Tokens added by this call stay valid until the parser is fed
+    ///       again or destroyed.
+    void finish();
+
+    /// \brief Drops the tokens consumed so far (words, titleWords and the
+    ///        anchor text of every link). Links and parser state are kept.
+    void clear_tokens();
+};
+
+/// \brief Hands out reusable parsers to indexing threads.
+/// \details A thread acquires a parser, reset()s it for each of its documents
+/// and releases it when done; the next thread to acquire gets it back with
+/// the capacity its vectors have grown to. The pool makes a parser when it is
+/// empty, so it ends up holding one per thread that parsed concurrently.
+/// Thread safe.
+class ParserPool {
+   public:
+    /// \brief Memory for the parsers' tokens and links; must outlive the pool
+    ///        and every parser it made.
+    explicit ParserPool(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+    ~ParserPool();
+    ParserPool(const ParserPool&) = delete;
+    ParserPool& operator=(const ParserPool&) = delete;
+
+    /// \brief A free parser, or a new one if none is free.
+    std::unique_ptr<HtmlParser> acquire();
+
+    /// \brief Returns \p parser to the pool for the next acquire().
+    void release(std::unique_ptr<HtmlParser> parser);
+
+   private:
+    std::pmr::memory_resource* resource_;
+    std::mutex lock_;
+    std::vector<std::unique_ptr<HtmlParser>> free_;
 };
@@ -1,44 +1,112 @@
 #include "html_tags.h"
+#include <array>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
 // name points to beginning of the possible HTML tag name.
 // nameEnd points to one past last character.
 // Comparison is case-insensitive.
-// Use a binary search.
 // If the name is found in the TagsRecognized table, return
 // the corresponding action.
 // If the name is not found, return OrdinaryText.
-inline char ToLower(char c) {
+//
+// The table is turned into a perfect hash at compile time: every tag name is
+// hashed with a seeded FNV-1a, and the first seed that puts all of them into
+// distinct slots is kept. A lookup lowercases the name once, hashes it and
+// compares against the single candidate in its slot.
+namespace {
+
+constexpr char ToLower(char c) {
     return (c >= 'A' && c <= 'Z') ? (c + ('a' - 'A')) : c;
 }
-inline bool IsEqual(char c1, char c2) {
-    return ToLower(c1) == ToLower(c2);
+
+constexpr size_t TagLength(const char *tag) {
+    size_t length = 0;
+    for (; tag[length] != '\0'; ++length) {
+    }
+    return length;
+}
+
+// Power of two, big enough that a collision-free seed turns up quickly.
+constexpr size_t TagTableSize = 2048;
+constexpr uint8_t EmptySlot = 0xFF;
+static_assert(NumberOfTags < EmptySlot, "tag index must fit in a slot");
+
+// name must already be lowercase.
+constexpr uint32_t HashTag(uint32_t seed, const char *name, size_t length) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+    }
+    return hash ^ (hash >> 15);
 }
-inline bool IsEqual(const char *s1_start, const char *s1_end, const char *s2_start,
-                    const char *s2_end) {
-    if (s1_end - s1_start != s2_end - s2_start) {
-        return false;
+
+struct TagTable {
+    uint32_t seed = 0;
+    std::array<uint8_t, TagTableSize> slots{};
+    std::array<uint8_t, NumberOfTags> lengths{};
+};
+
+constexpr bool TryBuild(uint32_t seed, TagTable &table) {
+    table.seed = seed;
+    for (auto &slot : table.slots) {
+        slot = EmptySlot;
     }
-    for (int i = 0; i < s1_end - s1_start; i++) {
-        if (!IsEqual(s1_start[i], s2_start[i])) {
+    for (int i = 0; i < NumberOfTags; ++i) {
+        size_t length = TagLength(TagsRecognized[i].Tag);
+        table.lengths[i] = static_cast<uint8_t>(length);
+        uint32_t slot = HashTag(seed, TagsRecognized[i].Tag, length) & (TagTableSize - 1);
+        if (table.slots[slot] != EmptySlot) {
             return false;
         }
+        table.slots[slot] = static_cast<uint8_t>(i);
     }
     return true;
 }
+
+constexpr TagTable BuildTagTable() {
+    TagTable table;
+    for (uint32_t seed = 0;; ++seed) {
+        if (TryBuild(seed, table)) {
+            return table;
+        }
+    }
+}
+
+constexpr TagTable Tags = BuildTagTable();
+
+constexpr size_t MaxTagLength() {
+    size_t longest = 0;
+    for (auto length : Tags.lengths) {
+        longest = length > longest ? length : longest;
+    }
+    return longest;
+}
+static_assert(MaxTagLength() == LongestTagLength, "LongestTagLength is stale");
+
+}  // namespace
+
 DesiredAction LookupPossibleTag(const char *name, const char *nameEnd) {
-    // Your code here.
-    // note: this is a naive implementation, we should use a binary search to
-    // improve performance
     if (name[0] == '!' && name[1] == '-' && name[2] == '-') {
         return DesiredAction::Comment;
     }
-    for (const auto &tag : TagsRecognized) {
-        if (IsEqual(name, nameEnd, tag.Tag, tag.Tag + strlen(tag.Tag))) {
-            return tag.Action;
-        }
+    if (nameEnd == nullptr) {
+        nameEnd = name + strlen(name);
+    }
+    size_t length = nameEnd - name;
+    if (length == 0 || length > LongestTagLength) {
+        return DesiredAction::OrdinaryText;
     }
 
-    return DesiredAction::OrdinaryText;
+    char lowered[LongestTagLength];
+    for (size_t i = 0; i < length; ++i) {
+        lowered[i] = ToLower(name[i]);
+    }
+    uint8_t index = Tags.slots[HashTag(Tags.seed, lowered, length) & (TagTableSize - 1)];
+    if (index == EmptySlot || Tags.lengths[index] != length ||
+        memcmp(TagsRecognized[index].Tag, lowered, length) != 0) {
+        return DesiredAction::OrdinaryText;
+    }
+    return TagsRecognized[index].Action;
 }
@@ -33,7 +33,9 @@ enum class DesiredAction {
 /// \param name Pointer to the start of the tag name.
 /// \param nameEnd Pointer to one past the last character of the name.
 /// \return DesiredAction for known tags, or DesiredAction::OrdinaryText.
-/// \note Comparison is case-insensitive. TagsRecognized is alpha-sorted.
+/// \note Comparison is case-insensitive. The lookup goes through a perfect
+///       hash table built from TagsRecognized at compile time, so a call costs
+///       one hash of at most LongestTagLength bytes and a single compare.
 DesiredAction LookupPossibleTag(const char *name, const char *nameEnd = nullptr);
 
 /// \brief Tag name and associated action.
@@ -42,11 +44,11 @@ class HtmlTag {
     const char *Tag;
     const DesiredAction Action;
 
-    HtmlTag(const char *tag, const DesiredAction action) : Tag(tag), Action(action) {}
+    constexpr HtmlTag(const char *tag, const DesiredAction action) : Tag(tag), Action(action) {}
 };
 
 /// \brief Alpha-sorted list of recognized tags.
-const HtmlTag TagsRecognized[] = {{"!--", DesiredAction::Comment},
+constexpr HtmlTag TagsRecognized[] = {{"!--", DesiredAction::Comment},
                                   {"!doctype", DesiredAction::Discard},
 
                                   {"a", DesiredAction::Anchor},
@@ -203,6 +205,6 @@ const HtmlTag TagsRecognized[] = {{"!--", DesiredAction::Comment},
                                   {"xmp", DesiredAction::Discard}};
 
 /// \brief Longest tag name length in TagsRecognized.
-const size_t LongestTagLength = 10;
+constexpr size_t LongestTagLength = 10;
 /// \brief Number of entries in TagsRecognized.
-const int NumberOfTags = sizeof(TagsRecognized) / sizeof(HtmlTag);
+constexpr int NumberOfTags = sizeof(TagsRecognized) / sizeof(HtmlTag);
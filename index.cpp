@@ -1,91 +1,588 @@
 #include "index.h"
 #include "html_parser.h"
+#include "pfor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <new>
+#include <set>
 #include <stdexcept>
+#include <unistd.h>
 /*
  * IndexWriter constructor
  */
 IndexWriter::IndexWriter(IndexWriterConfig *config, Directory *index_dir)
-    : config(config), index_dir(index_dir), term_dictionaries(), documents(),
-      docid(0) {}
+    : index_dir(index_dir), config(config),
+      ram_budget((std::size_t)(config->ram_buffer_size_mb * 1024 * 1024)),
+      segment_writers(), idle_segment_writers(), flush_pending(nullptr),
+      next_segment_id(0), closing(false), merging(false), docid(0),
+      flush_queue(config->max_pending_flushes), pending_flushes(0),
+      generation(0) {
+  flush_thread = std::thread(&IndexWriter::flush_loop, this);
+  merge_thread = std::thread(&IndexWriter::merge_loop, this);
+}
 /*
- * IndexWriter destructor
+ * IndexWriter destructor, waits for queued segments to be written and then
+ * for the merges they call for. What no commit has published is deleted:
+ * the index stays as of the last commit.
  */
-IndexWriter::~IndexWriter() = default;
+IndexWriter::~IndexWriter() {
+  flush_queue.close();
+  flush_thread.join();
+  {
+    std::lock_guard<std::mutex> guard(segments_lock);
+    closing = true;
+  }
+  merge_cond.notify_one();
+  merge_thread.join();
+  for (const auto &segment : segment_infos) {
+    for (const auto &filename : segment.get_files()) {
+      if (!commit_refs.count(filename)) {
+        index_dir->delete_file(filename);
+      }
+    }
+  }
+}
+
+/*
+ * Take an idle SegmentWriter for the calling thread, or start a new segment
+ * if every SegmentWriter is in use.
+ */
+SegmentWriter *IndexWriter::acquire_segment_writer() {
+  std::lock_guard<std::mutex> guard(segments_lock);
+  if (!idle_segment_writers.empty()) {
+    SegmentWriter *segment_writer = idle_segment_writers.back();
+    idle_segment_writers.pop_back();
+    return segment_writer;
+  }
+  segment_writers.push_back(std::make_unique<SegmentWriter>(next_segment_id++));
+  return segment_writers.back().get();
+}
+/*
+ * Return a SegmentWriter to the pool, or queue it for the flush thread if
+ * it is full. Past the RAM budget the largest SegmentWriter is queued: at
+ * once if it is idle, else when its thread returns it. Flushing whichever
+ * is idle instead would flush the small segments just started.
+ */
+void IndexWriter::release_segment_writer(SegmentWriter *segment_writer) {
+  std::unique_ptr<SegmentWriter> full;
+  {
+    std::lock_guard<std::mutex> guard(segments_lock);
+    idle_segment_writers.push_back(segment_writer);
+    SegmentWriter *to_flush = nullptr;
+    if (segment_writer == flush_pending ||
+        (config->max_buffered_docs > 0 &&
+         segment_writer->get_doc_count() >= config->max_buffered_docs)) {
+      to_flush = segment_writer;
+    } else if (ram_budget > 0 && !flush_pending) {
+      std::size_t ram_used = 0;
+      SegmentWriter *largest = nullptr;
+      for (const auto &writer : segment_writers) {
+        ram_used += writer->get_ram_bytes();
+        if (!largest || writer->get_ram_bytes() > largest->get_ram_bytes()) {
+          largest = writer.get();
+        }
+      }
+      if (ram_used > ram_budget) {
+        if (std::find(idle_segment_writers.begin(), idle_segment_writers.end(),
+                      largest) != idle_segment_writers.end()) {
+          to_flush = largest;
+        } else {
+          flush_pending = largest;
+        }
+      }
+    }
+    if (!to_flush) {
+      return;
+    }
+    if (to_flush == flush_pending) {
+      flush_pending = nullptr;
+    }
+    idle_segment_writers.erase(std::find(idle_segment_writers.begin(),
+                                         idle_segment_writers.end(), to_flush));
+    for (auto it = segment_writers.begin(); it != segment_writers.end(); ++it) {
+      if (it->get() == to_flush) {
+        full = std::move(*it);
+        segment_writers.erase(it);
+        break;
+      }
+    }
+  }
+  // outside the lock: this blocks while the flush thread is behind
+  queue_flush(std::move(full));
+}
+void IndexWriter::queue_flush(std::unique_ptr<SegmentWriter> segment_writer) {
+  pending_flushes++;
+  flush_queue.push(std::move(segment_writer));
+}
+/*
+ * Body of the flush thread: write queued segments until the queue is closed.
+ */
+void IndexWriter::flush_loop() {
+  std::unique_ptr<SegmentWriter> segment_writer;
+  while (flush_queue.pop(segment_writer, &flush_stats)) {
+    uint64_t start = StageStats::now_ns();
+    flush_segment(*segment_writer);
+    segment_writer.reset();
+    flush_stats.busy_ns += StageStats::now_ns() - start;
+    flush_stats.items++;
+    {
+      std::lock_guard<std::mutex> guard(segments_lock);
+      if (--pending_flushes > 0) {
+        continue;
+      }
+    }
+    flushes_done.notify_all();
+  }
+}
 
 /**
- * Add a document to the index.
+ * Add a document to the index. Safe to call from several threads.
+ * Nothing of the document is kept once this returns, so its content and
+ * memory resource may be released or reused.
  * @param document The document to add.
  */
 void IndexWriter::add_document(Document &document) {
-  // todo: Implement this
-  term_id_t term_id = 0; // term id within a field
+  std::unordered_map<std::string, term_id_t> positions; // per field
+  SegmentWriter *segment_writer = acquire_segment_writer();
+  // taken while holding the writer, so docids grow within each segment
   document.update_docid(docid++);
-  documents.push_back(document);
+  segment_writer->invert(document, positions);
+  segment_writer->finish_document();
+  release_segment_writer(segment_writer);
+}
+/**
+ * Add a document that is parsed incrementally, chunk by chunk.
+ * @param parser A parser that has not been fed yet.
+ * @param next_chunk Returns the next chunk of the document, or an empty view
+ * at the end. A chunk only has to stay valid until next_chunk is called again.
+ * Tokens are inverted after every chunk, so memory stays bounded by the chunk
+ * size instead of the document size.
+ */
+void IndexWriter::add_document(
+    HtmlParser &parser, const std::function<std::string_view()> &next_chunk) {
+  // per field, carried over the parts so a field's positions follow each
+  // other whatever the chunking
+  std::unordered_map<std::string, term_id_t> positions;
+  SegmentWriter *segment_writer = acquire_segment_writer();
+  docid_t current = docid++;
+  Arena part_arena;
+  auto invert_parsed = [&]() {
+    // a part only lives until its tokens are inverted
+    {
+      Document part(&parser, nullptr, 0, &part_arena);
+      part.update_docid(current);
+      segment_writer->invert(part, positions);
+    }
+    parser.clear_tokens();
+    part_arena.reset();
+  };
+  for (auto chunk = next_chunk(); !chunk.empty(); chunk = next_chunk()) {
+    parser.feed(chunk.data(), chunk.size());
+    invert_parsed();
+  }
+  parser.finish();
+  invert_parsed();
+  segment_writer->finish_document();
+  release_segment_writer(segment_writer);
+}
+/*
+ * Write one in-memory segment through the codec and record it.
+ */
+void IndexWriter::flush_segment(SegmentWriter &segment_writer) {
+  std::string segment_name =
+      "_" + std::to_string(segment_writer.get_segment_id());
+  std::cout << "Flushing segment " << segment_name << " ("
+            << segment_writer.get_doc_count() << " docs)" << std::endl;
+  for (const auto &[field_name, terms] :
+       segment_writer.get_term_dictionaries()) {
+    std::cout << "Field: " << field_name << " (" << terms.size()
+              << " terms)\n";
+  }
+  SegmentInfos info(segment_name, segment_writer.get_segment_id(), index_dir);
+  for (const auto &filename : config->codec->encode_term_dictionarie(
+           index_dir, segment_name,
+           segment_writer.get_term_dictionaries())) {
+    info.addFile(filename);
+  }
+  info.set_doc_count(segment_writer.get_doc_count());
+  {
+    std::lock_guard<std::mutex> guard(segments_lock);
+    segment_infos.push_back(std::move(info));
+  }
+  merge_cond.notify_one();
+}
+/*
+ * Body of the merge thread: merge what the policy picks until it picks
+ * nothing, then wait for the next written segment. Only one merge runs at
+ * a time, so the segments picked stay in segment_infos until it is done.
+ */
+void IndexWriter::merge_loop() {
+  std::unique_lock<std::mutex> lock(segments_lock);
+  for (;;) {
+    std::vector<std::size_t> picked;
+    if (config->merge_policy) {
+      picked = config->merge_policy->find_merge(segment_infos);
+    }
+    if (picked.empty()) {
+      merging = false;
+      merges_done.notify_all();
+      if (closing) {
+        return;
+      }
+      merge_cond.wait(lock);
+      continue;
+    }
+    merging = true;
+    std::vector<SegmentInfos> sources;
+    for (std::size_t i : picked) {
+      sources.push_back(segment_infos[i]);
+    }
+    segment_id_t segment_id = next_segment_id++;
+    lock.unlock();
+
+    uint64_t start = StageStats::now_ns();
+    std::string segment_name = "_" + std::to_string(segment_id);
+    SegmentInfos merged(segment_name, segment_id, index_dir);
+    docid_t doc_count = 0;
+    std::string source_names;
+    for (const auto &source : sources) {
+      doc_count += source.get_doc_count();
+      source_names += " " + source.get_name();
+    }
+    std::cout << "Merging segments" << source_names << " into "
+              << segment_name << " (" << doc_count << " docs)" << std::endl;
+    for (const auto &filename :
+         config->codec->merge_segments(index_dir, segment_name, sources)) {
+      merged.addFile(filename);
+    }
+    merged.set_doc_count(doc_count);
+
+    lock.lock();
+    std::erase_if(segment_infos, [&](const SegmentInfos &info) {
+      return std::any_of(sources.begin(), sources.end(),
+                         [&](const SegmentInfos &source) {
+                           return source.get_segment_id() ==
+                                  info.get_segment_id();
+                         });
+    });
+    segment_infos.push_back(std::move(merged));
+    // a commit still referencing a file deletes it once it no longer does
+    std::vector<std::string> to_delete;
+    for (const auto &source : sources) {
+      for (const auto &filename : source.get_files()) {
+        if (!commit_refs.count(filename)) {
+          to_delete.push_back(filename);
+        }
+      }
+    }
+    lock.unlock();
+    for (const auto &filename : to_delete) {
+      index_dir->delete_file(filename);
+    }
+    merge_stats.busy_ns += StageStats::now_ns() - start;
+    merge_stats.items++;
+    lock.lock();
+  }
+}
+/*
+ * Flush every per-thread segment as its own segment and wait until all of
+ * them, and any queued earlier, are written. Must not run while documents
+ * are being added.
+ */
+void IndexWriter::flush() {
+  std::cout << "Flushing index..." << std::endl;
+  std::vector<std::unique_ptr<SegmentWriter>> to_flush;
+  {
+    std::lock_guard<std::mutex> guard(segments_lock);
+    // flushed segments are immutable, new documents go to new segments
+    to_flush.swap(segment_writers);
+    idle_segment_writers.clear();
+    flush_pending = nullptr;
+  }
+  for (auto &segment_writer : to_flush) {
+    if (segment_writer->get_doc_count() > 0) {
+      queue_flush(std::move(segment_writer));
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lock(segments_lock);
+    flushes_done.wait(lock, [&] { return pending_flushes == 0; });
+  }
+  std::cout << "Index flushed" << std::endl;
+}
+/*
+ * Block until the merge thread is idle and the merge policy has nothing
+ * left to merge.
+ */
+void IndexWriter::wait_for_merges() {
+  std::unique_lock<std::mutex> lock(segments_lock);
+  merges_done.wait(lock, [&] {
+    return !merging && (!config->merge_policy ||
+                        config->merge_policy->find_merge(segment_infos)
+                            .empty());
+  });
+}
+void IndexWriter::commit() {
+  flush();
+  publish();
+}
+void IndexWriter::publish() {
+  std::lock_guard<std::mutex> commit_guard(commit_lock);
+  std::vector<SegmentInfos> segments;
+  std::vector<std::string> files;
+  {
+    std::lock_guard<std::mutex> guard(segments_lock);
+    segments = segment_infos;
+    for (const auto &segment : segments) {
+      files.insert(files.end(), segment.get_files().begin(),
+                   segment.get_files().end());
+    }
+    if (generation > 0 && files == committed_files) {
+      return; // nothing changed
+    }
+    // from now on merges leave these files for this commit
+    for (const auto &filename : files) {
+      commit_refs[filename]++;
+    }
+  }
+  try {
+    std::vector<std::string> to_sync;
+    for (const auto &filename : files) {
+      if (!synced_files.count(filename)) {
+        to_sync.push_back(filename);
+      }
+    }
+    index_dir->sync(to_sync);
+    synced_files.insert(to_sync.begin(), to_sync.end());
+    SegmentsFile::write(index_dir, generation + 1, segments);
+  } catch (...) {
+    std::lock_guard<std::mutex> guard(segments_lock);
+    for (const auto &filename : files) {
+      if (--commit_refs[filename] == 0) {
+        commit_refs.erase(filename);
+      }
+    }
+    throw;
+  }
+
+  std::vector<std::string> to_delete;
+  if (generation > 0) {
+    to_delete.push_back(SegmentsFile::file_name(generation));
+  }
+  {
+    std::lock_guard<std::mutex> guard(segments_lock);
+    std::set<std::string> live;
+    for (const auto &segment : segment_infos) {
+      live.insert(segment.get_files().begin(), segment.get_files().end());
+    }
+    for (const auto &filename : committed_files) {
+      if (--commit_refs[filename] == 0) {
+        commit_refs.erase(filename);
+        if (!live.count(filename)) {
+          to_delete.push_back(filename);
+        }
+      }
+    }
+  }
+  generation++;
+  committed_files = std::move(files);
+  for (const auto &filename : to_delete) {
+    index_dir->delete_file(filename);
+    synced_files.erase(filename);
+  }
+  std::cout << "Committed " << SegmentsFile::file_name(generation) << " ("
+            << segments.size() << " segments)" << std::endl;
+}
+const StageStats &IndexWriter::get_flush_stats() const { return flush_stats; }
+const StageStats &IndexWriter::get_merge_stats() const { return merge_stats; }
+const BoundedQueue<std::unique_ptr<SegmentWriter>> &
+IndexWriter::get_flush_queue() const {
+  return flush_queue;
+}
+
+/*
+ * SegmentWriter constructor
+ */
+SegmentWriter::SegmentWriter(segment_id_t segment_id)
+    : segment_id(segment_id), term_dictionaries(), doc_count(0),
+      ram_bytes(0) {}
+/*
+ * SegmentWriter destructor
+ */
+SegmentWriter::~SegmentWriter() = default;
+/*
+ * Add the words of every field of document to the term dictionaries. Every
+ * field counts its own positions, from 0 in each document.
+ */
+void SegmentWriter::invert(
+    const Document &document,
+    std::unordered_map<std::string, term_id_t> &positions) {
   for (const auto &field : document.fields) {
+    term_id_t &term_id = positions[field.name];
     for (const auto &word : field.get_words()) {
       term_dictionaries[field.name].add_term(word, document.get_docid(),
                                              term_id++);
     }
   }
 }
-void IndexWriter::flush() {
-  // todo: Implement this
-  std::cout << "Flushing index..." << std::endl;
+void SegmentWriter::finish_document() {
+  doc_count++;
+  ram_bytes = bytes_used();
+}
+const segment_id_t &SegmentWriter::get_segment_id() const {
+  return segment_id;
+}
+const docid_t &SegmentWriter::get_doc_count() const { return doc_count; }
+std::size_t SegmentWriter::bytes_used() const {
+  std::size_t bytes = 0;
   for (const auto &[field_name, terms] : term_dictionaries) {
-    std::cout << "Field: " << field_name << "\n";
-    terms.print();
+    bytes += sizeof(TermDictionary) + field_name.capacity() +
+             terms.bytes_used();
   }
-  config->codec->encode_term_dictionarie(index_dir, term_dictionaries);
-  std::cout << "Index flushed" << std::endl;
-  docid = 0;
+  return bytes;
 }
+std::unordered_map<std::string, TermDictionary> &
+SegmentWriter::get_term_dictionaries() {
+  return term_dictionaries;
+}
+
 /*
  * TermDictionary constructor
  */
-TermDictionary::TermDictionary() : term_dictionary() {}
+TermDictionary::TermDictionary() = default;
 /*
- * TermDictionary destructor
+ * TermDictionary add_term method, allocates only when the pools or the per
+ * term arrays have to grow.
  */
-// TermDictionary::~TermDictionary() {}
-/*
- * TermDictionary add_term method
- */
-void TermDictionary::add_term(const std::string &term, const docid_t &docid,
+void TermDictionary::add_term(std::string_view term, const docid_t &docid,
                               const term_id_t &term_id) {
-  term_dictionary[term][docid].push_back(term_id);
+  if (length_docids.empty() || length_docids.back() != docid) {
+    length_docids.push_back(docid);
+    lengths.push_back(0);
+  }
+  lengths.back()++;
+  bool is_new;
+  int32_t id = terms.add(term, is_new);
+  if (id < 0) {
+    return; // longer than TermsHash::MaxTermLength
+  }
+  if (is_new) {
+    uint32_t doc_start = postings.new_slice();
+    uint32_t position_start = postings.new_slice();
+    doc_starts.push_back(doc_start);
+    doc_uptos.push_back(doc_start);
+    position_starts.push_back(position_start);
+    position_uptos.push_back(position_start);
+    last_docids.push_back(docid);
+    last_positions.push_back(0);
+    term_freqs.push_back(0);
+    doc_freqs.push_back(1);
+    postings.write_vint(doc_uptos[id], docid);
+  } else if (docid != last_docids[id]) {
+    postings.write_vint(doc_uptos[id], term_freqs[id]);
+    postings.write_vint(doc_uptos[id], docid - last_docids[id]);
+    last_docids[id] = docid;
+    last_positions[id] = 0;
+    term_freqs[id] = 0;
+    doc_freqs[id]++;
+  }
+  postings.write_vint(position_uptos[id], term_id - last_positions[id]);
+  last_positions[id] = term_id;
+  term_freqs[id]++;
 }
 
-const std::vector<term_id_t> &
-TermDictionary::get_term(const std::string &term, const docid_t &docid) const {
-  if (term_dictionary.find(term) == term_dictionary.end()) {
+std::vector<term_id_t> TermDictionary::get_term(std::string_view term,
+                                                const docid_t &docid) const {
+  int32_t id = terms.find(term);
+  if (id < 0) {
     throw std::runtime_error("Term not found");
   }
-  if (term_dictionary.at(term).find(docid) == term_dictionary.at(term).end()) {
+  std::vector<term_id_t> found;
+  bool has_doc = false;
+  read_postings(id, [&](const docid_t &doc,
+                        const std::vector<term_id_t> &positions) {
+    if (doc == docid) {
+      found = positions;
+      has_doc = true;
+    }
+  });
+  if (!has_doc) {
     throw std::runtime_error("Docid not found");
   }
-  return term_dictionary.at(term).at(docid);
+  return found;
+}
+
+std::string_view TermDictionary::get_word(std::size_t id) const {
+  return terms.get(id);
+}
+
+void TermDictionary::read_postings(
+    std::size_t id,
+    const std::function<void(const docid_t &, const std::vector<term_id_t> &)>
+        &visit) const {
+  ByteSliceReader docs(&postings, doc_starts[id], doc_uptos[id]);
+  ByteSliceReader positions(&postings, position_starts[id],
+                            position_uptos[id]);
+  std::vector<term_id_t> doc_positions;
+  docid_t docid = 0;
+  while (!docs.eof()) {
+    docid += docs.read_vint();
+    // the freq of the last doc is not written yet
+    uint64_t freq = docs.eof() ? term_freqs[id] : docs.read_vint();
+    doc_positions.clear();
+    term_id_t position = 0;
+    for (uint64_t i = 0; i < freq; ++i) {
+      position += positions.read_vint();
+      doc_positions.push_back(position);
+    }
+    visit(docid, doc_positions);
+  }
 }
 
 void TermDictionary::print() const {
-  for (const auto &[term, docs] : term_dictionary) {
-    std::cout << "Term: " << term << "\n";
-    for (const auto &[docid, term_ids] : docs) {
+  for (std::size_t id = 0; id < terms.size(); ++id) {
+    std::cout << "Term: " << terms.get(id) << "\n";
+    read_postings(id, [](const docid_t &docid,
+                         const std::vector<term_id_t> &term_ids) {
       std::cout << "  Docid: " << docid << "\n";
       for (const auto &term_id : term_ids) {
         std::cout << "    Term id: " << term_id << "\n";
       }
-    }
+    });
     std::cout << std::endl;
   }
 }
-std::string TermDictionary::to_string() const {
+std::size_t TermDictionary::size() const { return terms.size(); }
+std::size_t TermDictionary::bytes_used() const {
+  return terms.bytes_used() + postings.bytes_used() +
+         (doc_starts.capacity() + doc_uptos.capacity() +
+          position_starts.capacity() + position_uptos.capacity() +
+          term_freqs.capacity() + doc_freqs.capacity() + lengths.capacity()) *
+             sizeof(uint32_t) +
+         (last_docids.capacity() + length_docids.capacity()) *
+             sizeof(docid_t) +
+         last_positions.capacity() * sizeof(term_id_t);
+}
+const std::vector<docid_t> &TermDictionary::get_length_docids() const {
+  return length_docids;
+}
+const std::vector<uint32_t> &TermDictionary::get_lengths() const {
+  return lengths;
+}
+void TermDictionary::write_to(IndexOutput &output) const {
   std::string content;
-  for (const auto &[term, docs] : term_dictionary) {
-    content += term + ": ";
-    for (const auto &[doc_id, positions] : docs) {
+  for (std::size_t id = 0; id < terms.size(); ++id) {
+    content.clear();
+    content += terms.get(id);
+    content += ": ";
+    read_postings(id, [&](const docid_t &doc_id,
+                          const std::vector<term_id_t> &positions) {
       content += "d" + std::to_string(doc_id) + "[";
       for (size_t i = 0; i < positions.size(); ++i) {
         if (i > 0)
@@ -93,10 +590,10 @@ std::string TermDictionary::to_string() const {
         content += std::to_string(positions[i]);
       }
       content += "] ";
-    }
+    });
     content += "\n";
+    output.write_bytes(content);
   }
-  return content;
 }
 /*
  * Term constructor
@@ -110,8 +607,9 @@ Term::~Term() = default;
 /*
  * Field constructor
  */
-Field::Field(std::string name, FieldType type, const std::string &value)
-    : name(name), type(type), value(value), words() {}
+Field::Field(std::string name, FieldType type, const std::string &value,
+             std::pmr::memory_resource *resource)
+    : value(value), type(type), words(resource), name(name) {}
 /*
  * Field destructor
  */
@@ -120,10 +618,13 @@ Field::~Field() = default;
 /*
  * Field methods
  */
-const std::vector<std::string> &Field::get_words() const { return words; }
+const std::pmr::vector<std::string_view> &Field::get_words() const {
+  return words;
+}
 const std::string &Term::get_word() const { return word; }
 Field *Term::get_field() const { return field; }
-void Field::add_word(const std::string &word) { words.push_back(word); }
+void Field::add_word(std::string_view word) { words.push_back(word); }
+void Field::reserve_words(std::size_t count) { words.reserve(count); }
 
 /*
  * Analyzer constructor
@@ -139,12 +640,22 @@ Analyzer::~Analyzer() = default;
  * Document constructor
  */
 // note: invalid operation
-Document::Document(HtmlParser *parser, char *content, size_t content_size)
-    : parser(parser), content(content), content_size(content_size) {
+Document::Document(HtmlParser *parser, const char *content,
+                   size_t content_size, std::pmr::memory_resource *resource)
+    : parser(parser), content(content), content_size(content_size),
+      fields(resource) {
   // todo: read the segments in the directory
-  Field body_field("body", FieldType::BODY, "");
-  Field title_field("title", FieldType::TITLE, "");
-  Field anchor_field("anchor", FieldType::ANCHOR, "");
+  Field body_field("body", FieldType::BODY, "", resource);
+  Field title_field("title", FieldType::TITLE, "", resource);
+  Field anchor_field("anchor", FieldType::ANCHOR, "", resource);
+  std::size_t anchor_words = 0;
+  for (const auto &link : parser->links) {
+    anchor_words += link.anchorText.size();
+  }
+  // sized once, an arena never gets back the memory of a grown vector
+  body_field.reserve_words(parser->words.size());
+  title_field.reserve_words(parser->titleWords.size());
+  anchor_field.reserve_words(anchor_words);
   for (const auto &word : parser->words) {
     body_field.add_word(word);
   }
@@ -156,9 +667,10 @@ Document::Document(HtmlParser *parser, char *content, size_t content_size)
       anchor_field.add_word(word);
     }
   }
-  fields.push_back(body_field);
-  fields.push_back(title_field);
-  fields.push_back(anchor_field);
+  fields.reserve(3);
+  fields.push_back(std::move(body_field));
+  fields.push_back(std::move(title_field));
+  fields.push_back(std::move(anchor_field));
 }
 /*
  * Document destructor
@@ -176,15 +688,136 @@ const docid_t &Document::get_docid() const { return docid; }
 /*
  * SegmentInfos constructor
  */
-SegmentInfos::SegmentInfos(const std::string &name, segment_id_t segment_id)
-    : segment_id(segment_id), directory(new LocalDirectory(name)) {}
-SegmentInfos::~SegmentInfos() { delete directory; }
+SegmentInfos::SegmentInfos(const std::string &name, segment_id_t segment_id,
+                           Directory *directory)
+    : segment_id(segment_id), segment_name(name), directory(directory),
+      doc_count(0), files() {}
+SegmentInfos::~SegmentInfos() = default;
+/*
+ * SegmentInfos methods
+ */
+void SegmentInfos::addFile(const std::string &filename) {
+  files.push_back(filename);
+}
+void SegmentInfos::set_doc_count(const docid_t &doc_count) {
+  this->doc_count = doc_count;
+}
+const std::string &SegmentInfos::get_name() const { return segment_name; }
+const segment_id_t &SegmentInfos::get_segment_id() const { return segment_id; }
+const docid_t &SegmentInfos::get_doc_count() const { return doc_count; }
+const std::vector<std::string> &SegmentInfos::get_files() const {
+  return files;
+}
+std::vector<std::string> SegmentInfos::get_field_names() const {
+  std::set<std::string> field_names;
+  for (const auto &filename : files) {
+    std::size_t extension_start = filename.rfind('.');
+    if (filename.compare(0, segment_name.size() + 1, segment_name + ".") ==
+            0 &&
+        extension_start > segment_name.size()) {
+      field_names.insert(filename.substr(
+          segment_name.size() + 1, extension_start - segment_name.size() - 1));
+    }
+  }
+  return std::vector<std::string>(field_names.begin(), field_names.end());
+}
+
+std::string SegmentsFile::file_name(uint64_t generation) {
+  return "segments_" + std::to_string(generation);
+}
+uint64_t
+SegmentsFile::latest_generation(const std::vector<std::string> &filenames) {
+  const std::string prefix = "segments_";
+  uint64_t latest = 0;
+  for (const auto &filename : filenames) {
+    if (filename.size() > prefix.size() &&
+        filename.compare(0, prefix.size(), prefix) == 0 &&
+        filename.find_first_not_of("0123456789", prefix.size()) ==
+            std::string::npos) {
+      latest = std::max<uint64_t>(latest,
+                                  std::stoull(filename.substr(prefix.size())));
+    }
+  }
+  return latest;
+}
+void SegmentsFile::write(Directory *directory, uint64_t generation,
+                         const std::vector<SegmentInfos> &segments) {
+  std::string pending = "pending_" + file_name(generation);
+  auto output = directory->create_output(pending);
+  output->write_bytes(Magic, 4);
+  output->write_vint(Version);
+  output->write_vint(generation);
+  output->write_vint(segments.size());
+  for (const auto &segment : segments) {
+    output->write_vint(segment.get_segment_id());
+    output->write_vint(segment.get_doc_count());
+    output->write_vint(segment.get_files().size());
+    for (const auto &filename : segment.get_files()) {
+      output->write_vint(filename.size());
+      output->write_bytes(filename);
+    }
+  }
+  output->write_footer();
+  output->close();
+  directory->sync({pending});
+  directory->rename_file(pending, file_name(generation));
+  directory->sync_metadata();
+}
+std::vector<SegmentInfos> SegmentsFile::read(Directory *directory,
+                                             uint64_t generation) {
+  std::string filename = file_name(generation);
+  auto input = directory->open_input(filename);
+  input->check_footer();
+  uint64_t end = input->get_file_pointer();
+  input->seek(0);
+  char magic[4];
+  input->read_bytes(magic, 4);
+  if (std::memcmp(magic, Magic, 4) != 0) {
+    throw std::runtime_error("Not a segments file: " + filename);
+  }
+  if (input->read_vint() != Version || input->read_vint() != generation) {
+    throw std::runtime_error("Unknown version of " + filename);
+  }
+  auto corrupt = [&]() {
+    return std::runtime_error("Corrupt segments file: " + filename);
+  };
+  std::vector<SegmentInfos> segments;
+  for (uint64_t count = input->read_vint(); count > 0; --count) {
+    if (input->get_file_pointer() >= end) {
+      throw corrupt();
+    }
+    segment_id_t segment_id = input->read_vint();
+    SegmentInfos segment("_" + std::to_string(segment_id), segment_id,
+                         directory);
+    segment.set_doc_count(input->read_vint());
+    for (uint64_t files = input->read_vint(); files > 0; --files) {
+      uint64_t length = input->read_vint();
+      if (length > end - std::min(end, input->get_file_pointer())) {
+        throw corrupt();
+      }
+      std::string name(length, '\0');
+      input->read_bytes(name.data(), length);
+      segment.addFile(std::move(name));
+    }
+    segments.push_back(std::move(segment));
+  }
+  if (input->get_file_pointer() != end) {
+    throw corrupt();
+  }
+  return segments;
+}
 
 /*
  * LocalDirectory constructor
  */
-LocalDirectory::LocalDirectory(const std::string &directory_name)
+LocalDirectory::LocalDirectory(const std::string &directory_name, bool create)
     : Directory(directory_name) {
+  if (!create) {
+    if (!std::filesystem::is_directory(directory_name)) {
+      throw std::runtime_error("Directory does not exist");
+    }
+    return;
+  }
   if (std::filesystem::exists(directory_name)) {
     throw std::runtime_error("Directory already exists");
   }
@@ -197,20 +830,273 @@ LocalDirectory::LocalDirectory(const std::string &directory_name)
  */
 LocalDirectory::~LocalDirectory() = default;
 /*
- * LocalDirectory create_file method
+ * LocalDirectory create_output method
+ */
+std::unique_ptr<IndexOutput>
+LocalDirectory::create_output(const std::string &filename) {
+  return std::make_unique<FileIndexOutput>(directory_name + "/" + filename,
+                                           filename);
+}
+/*
+ * LocalDirectory open_input method
+ */
+std::unique_ptr<IndexInput>
+LocalDirectory::open_input(const std::string &filename) {
+  return std::make_unique<FileIndexInput>(directory_name + "/" + filename,
+                                          filename);
+}
+/*
+ * LocalDirectory list_files method
+ */
+std::vector<std::string> LocalDirectory::list_files() {
+  std::vector<std::string> filenames;
+  for (const auto &entry : std::filesystem::directory_iterator(directory_name)) {
+    if (entry.is_regular_file()) {
+      filenames.push_back(entry.path().filename().string());
+    }
+  }
+  std::sort(filenames.begin(), filenames.end());
+  return filenames;
+}
+/*
+ * LocalDirectory delete_file method
+ */
+void LocalDirectory::delete_file(const std::string &filename) {
+  std::filesystem::remove(directory_name + "/" + filename);
+}
+/*
+ * LocalDirectory sync method
+ */
+void LocalDirectory::sync(const std::vector<std::string> &filenames) {
+  for (const auto &filename : filenames) {
+    std::string path = directory_name + "/" + filename;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Failed to open " + path);
+    }
+    int result = fsync(fd);
+    close(fd);
+    if (result != 0) {
+      throw std::runtime_error("Failed to sync " + path);
+    }
+  }
+}
+/*
+ * LocalDirectory rename_file method
+ */
+void LocalDirectory::rename_file(const std::string &from,
+                                 const std::string &to) {
+  if (std::rename((directory_name + "/" + from).c_str(),
+                  (directory_name + "/" + to).c_str()) != 0) {
+    throw std::runtime_error("Failed to rename " + from + " to " + to);
+  }
+}
+/*
+ * LocalDirectory sync_metadata method
+ */
+void LocalDirectory::sync_metadata() {
+  int fd = open(directory_name.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open " + directory_name);
+  }
+  int result = fsync(fd);
+  close(fd);
+  if (result != 0) {
+    throw std::runtime_error("Failed to sync " + directory_name);
+  }
+}
+/*
+ * LocalDirectory map_file method
+ */
+std::unique_ptr<MappedFile>
+LocalDirectory::map_file(const std::string &filename) {
+  return std::make_unique<MappedFile>(directory_name + "/" + filename, false);
+}
+
+/*
+ * RAMFile constructor
+ */
+RAMFile::RAMFile() : buffer(nullptr), length(0), capacity(0) {}
+/*
+ * RAMFile constructor, copying data
+ */
+RAMFile::RAMFile(const char *data, std::size_t length) : RAMFile() {
+  append(data, length);
+}
+/*
+ * RAMFile destructor
+ */
+RAMFile::~RAMFile() { std::free(buffer); }
+
+void RAMFile::append(const void *data, std::size_t length) {
+  if (this->length + length > capacity) {
+    std::size_t grown = std::max(capacity * 2, this->length + length);
+    char *moved = static_cast<char *>(std::realloc(buffer, grown));
+    if (!moved) {
+      throw std::bad_alloc();
+    }
+    buffer = moved;
+    capacity = grown;
+  }
+  std::memcpy(buffer + this->length, data, length);
+  this->length += length;
+}
+
+/*
+ * RAMIndexOutput builds a file and publishes it to its RAMDirectory on
+ * close().
+ */
+class RAMIndexOutput : public IndexOutput {
+  RAMDirectory *directory; // not owned
+  std::shared_ptr<RAMFile> content;
+
+protected:
+  // an IndexOutput writes from start to end, which is all a RAMFile does
+  void write_at(uint64_t offset, const uint8_t *data,
+                std::size_t length) override {
+    if (!content || offset != content->size()) {
+      throw std::runtime_error("Failed to write file: " + get_name());
+    }
+    content->append(data, length);
+  }
+
+public:
+  RAMIndexOutput(RAMDirectory *directory, const std::string &name)
+      : IndexOutput(name), directory(directory),
+        content(std::make_shared<RAMFile>()) {}
+  // publishes the file; content is gone after, so a second close throws
+  void close() override {
+    if (!content) {
+      throw std::runtime_error("Failed to close file: " + get_name());
+    }
+    IndexOutput::close();
+    directory->put_file(get_name(), std::move(content));
+  }
+};
+
+/*
+ * RAMIndexInput reads a file of a RAMDirectory as it was when opened.
  */
-void LocalDirectory::create_file(const std::string &filename) {
-  std::ofstream file(directory_name + "/" + filename);
-  file.close();
+class RAMIndexInput : public IndexInput {
+  std::shared_ptr<const RAMFile> content;
+
+protected:
+  void read_at(uint64_t offset, uint8_t *data, std::size_t length) override {
+    std::memcpy(data, content->data() + offset, length);
+  }
+
+public:
+  RAMIndexInput(std::shared_ptr<const RAMFile> content,
+                const std::string &name)
+      : IndexInput(name, content->size()), content(std::move(content)) {}
+};
+
+/*
+ * RAMDirectory constructor
+ */
+RAMDirectory::RAMDirectory() = default;
+/*
+ * RAMDirectory constructor, copying source
+ */
+RAMDirectory::RAMDirectory(Directory *source) {
+  for (const auto &filename : source->list_files()) {
+    auto file = source->map_file(filename);
+    files[filename] = std::make_shared<const RAMFile>(file->data(), file->size());
+  }
 }
 /*
- * LocalDirectory write_file method
+ * RAMDirectory destructor
  */
-void LocalDirectory::write_file(const std::string &filename,
-                                const std::string &content) {
-  std::ofstream file(directory_name + "/" + filename);
-  file << content;
-  file.close();
+RAMDirectory::~RAMDirectory() = default;
+/*
+ * RAMDirectory create_output method
+ */
+std::unique_ptr<IndexOutput>
+RAMDirectory::create_output(const std::string &filename) {
+  put_file(filename, std::make_shared<const RAMFile>());
+  return std::make_unique<RAMIndexOutput>(this, filename);
+}
+/*
+ * RAMDirectory open_input method
+ */
+std::unique_ptr<IndexInput>
+RAMDirectory::open_input(const std::string &filename) {
+  return std::make_unique<RAMIndexInput>(get_file(filename), filename);
+}
+/*
+ * RAMDirectory list_files method
+ */
+std::vector<std::string> RAMDirectory::list_files() {
+  std::lock_guard<std::mutex> guard(files_lock);
+  std::vector<std::string> filenames;
+  for (const auto &[filename, content] : files) {
+    filenames.push_back(filename);
+  }
+  return filenames;
+}
+/*
+ * RAMDirectory delete_file method
+ */
+void RAMDirectory::delete_file(const std::string &filename) {
+  std::lock_guard<std::mutex> guard(files_lock);
+  files.erase(filename);
+}
+/*
+ * RAMDirectory sync method, only checks that the files exist
+ */
+void RAMDirectory::sync(const std::vector<std::string> &filenames) {
+  for (const auto &filename : filenames) {
+    get_file(filename);
+  }
+}
+/*
+ * RAMDirectory rename_file method
+ */
+void RAMDirectory::rename_file(const std::string &from,
+                               const std::string &to) {
+  std::lock_guard<std::mutex> guard(files_lock);
+  auto it = files.find(from);
+  if (it == files.end()) {
+    throw std::runtime_error("Failed to rename " + from + " to " + to);
+  }
+  auto content = std::move(it->second);
+  files.erase(it);
+  files[to] = std::move(content);
+}
+/*
+ * RAMDirectory sync_metadata method
+ */
+void RAMDirectory::sync_metadata() {}
+/*
+ * RAMDirectory map_file method
+ */
+std::unique_ptr<MappedFile>
+RAMDirectory::map_file(const std::string &filename) {
+  auto content = get_file(filename);
+  return std::make_unique<MappedFile>(content->data(), content->size(),
+                                      content);
+}
+std::shared_ptr<const RAMFile>
+RAMDirectory::get_file(const std::string &filename) const {
+  std::lock_guard<std::mutex> guard(files_lock);
+  auto it = files.find(filename);
+  if (it == files.end()) {
+    throw std::runtime_error("Failed to open " + filename);
+  }
+  return it->second;
+}
+std::size_t RAMDirectory::size_in_bytes() const {
+  std::lock_guard<std::mutex> guard(files_lock);
+  std::size_t bytes = 0;
+  for (const auto &[filename, content] : files) {
+    bytes += content->size();
+  }
+  return bytes;
+}
+void RAMDirectory::put_file(const std::string &filename,
+                            std::shared_ptr<const RAMFile> content) {
+  std::lock_guard<std::mutex> guard(files_lock);
+  files[filename] = std::move(content);
 }
 /*
  * Paragraph constructor
@@ -222,19 +1108,98 @@ Paragraph::~Paragraph() = default;
  */
 Codec::Codec() = default;
 Codec::~Codec() = default;
+IndexWriterConfig::~IndexWriterConfig() = default;
+IndexWriterConfig::IndexWriterConfig(Codec *codec, docid_t max_buffered_docs,
+                                     double ram_buffer_size_mb,
+                                     std::size_t max_pending_flushes,
+                                     MergePolicy *merge_policy)
+    : codec(codec), max_buffered_docs(max_buffered_docs),
+      ram_buffer_size_mb(ram_buffer_size_mb),
+      max_pending_flushes(max_pending_flushes), merge_policy(merge_policy) {}
+
+/*
+ * MergePolicy constructor
+ */
+MergePolicy::MergePolicy() = default;
+MergePolicy::~MergePolicy() = default;
+
 /*
- * Codec encode_term_dictionarie method
+ * TieredMergePolicy constructor
  */
-void Codec::encode_term_dictionarie(
-    Directory *directory,
-    std::unordered_map<std::string, TermDictionary> &term_dictionaries) {
-  std::cout << "Encoding term dictionary..." << std::endl;
-  for (const auto &[field_name, term_dictionary] : term_dictionaries) {
-    std::string filename = field_name + ".txt";
-    directory->create_file(filename);
-    directory->write_file(filename, term_dictionary.to_string());
+TieredMergePolicy::TieredMergePolicy(std::size_t max_merge_at_once,
+                                     std::size_t segments_per_tier,
+                                     docid_t floor_docs,
+                                     docid_t max_merged_docs)
+    : max_merge_at_once(max_merge_at_once),
+      segments_per_tier(segments_per_tier), floor_docs(floor_docs),
+      max_merged_docs(max_merged_docs) {}
+TieredMergePolicy::~TieredMergePolicy() = default;
+
+std::vector<std::size_t> TieredMergePolicy::find_merge(
+    const std::vector<SegmentInfos> &segments) const {
+  auto size = [&](std::size_t i) {
+    return std::max(segments[i].get_doc_count(), floor_docs);
+  };
+  // largest first
+  std::vector<std::size_t> eligible;
+  docid_t total = 0;
+  for (std::size_t i = 0; i < segments.size(); ++i) {
+    if (segments[i].get_doc_count() <= max_merged_docs / 2) {
+      eligible.push_back(i);
+      total += size(i);
+    }
+  }
+  std::stable_sort(eligible.begin(), eligible.end(),
+                   [&](std::size_t a, std::size_t b) {
+                     return size(a) > size(b);
+                   });
+  if (eligible.size() < 2) {
+    return {};
   }
-}
 
-IndexWriterConfig::~IndexWriterConfig() = default;
-IndexWriterConfig::IndexWriterConfig(Codec *codec) : codec(codec) {}
\ No newline at end of file
+  // segments the tiers allow for that many docs
+  std::size_t allowed = 0;
+  docid_t tier_size = size(eligible.back());
+  for (docid_t left = total;;) {
+    std::size_t tier_segments = (left + tier_size - 1) / tier_size;
+    if (tier_segments <= segments_per_tier) {
+      allowed += tier_segments;
+      break;
+    }
+    allowed += segments_per_tier;
+    left -= segments_per_tier * tier_size;
+    tier_size *= max_merge_at_once;
+  }
+  if (eligible.size() <= allowed) {
+    return {};
+  }
+
+  std::vector<std::size_t> best;
+  double best_score = 0;
+  for (std::size_t first = 0; first + 1 < eligible.size(); ++first) {
+    std::vector<std::size_t> candidate;
+    docid_t merged_docs = 0;
+    docid_t merged_size = 0;
+    for (std::size_t i = first;
+         i < eligible.size() && candidate.size() < max_merge_at_once; ++i) {
+      docid_t docs = segments[eligible[i]].get_doc_count();
+      if (merged_docs + docs > max_merged_docs) {
+        continue; // a smaller one may still fit
+      }
+      candidate.push_back(eligible[i]);
+      merged_docs += docs;
+      merged_size += size(eligible[i]);
+    }
+    if (candidate.size() < 2) {
+      continue;
+    }
+    // skew, slightly favouring smaller merges
+    double score = (double)size(candidate.front()) / merged_size *
+                   std::pow((double)merged_docs, 0.05);
+    if (best.empty() || score < best_score) {
+      best = std::move(candidate);
+      best_score = score;
+    }
+  }
+  return best;
+}
\ No newline at end of file
@@ -1,10 +1,25 @@
 // query class
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
-#include <html_parser.h>
+#include <functional>
+#include "arena.h"
+#include "html_parser.h"
+#include "ingest.h"
+#include "postings.h"
+#include "queue.h"
+#include "store.h"
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 typedef std::size_t docid_t;
@@ -26,18 +41,98 @@ public:
   Directory() = default;
   Directory(const std::string &directory_name)
       : directory_name(directory_name) {}
-  virtual void create_file(const std::string &filename) = 0;
-  virtual void write_file(const std::string &filename,
-                          const std::string &content) = 0;
+  // creates filename, or truncates it, to be written from the start
+  virtual std::unique_ptr<IndexOutput>
+  create_output(const std::string &filename) = 0;
+  virtual std::unique_ptr<IndexInput>
+  open_input(const std::string &filename) = 0;
+  // names of the files in the directory, sorted
+  virtual std::vector<std::string> list_files() = 0;
+  virtual void delete_file(const std::string &filename) = 0;
+  // makes the content of the files durable
+  virtual void sync(const std::vector<std::string> &filenames) = 0;
+  // atomically replaces to, if it exists, with from
+  virtual void rename_file(const std::string &from, const std::string &to) = 0;
+  // makes the creations, renames and deletions so far durable
+  virtual void sync_metadata() = 0;
+  // read-only view of a file, valid as long as the returned object
+  virtual std::unique_ptr<MappedFile> map_file(const std::string &filename) = 0;
   virtual ~Directory() = default;
 };
 class LocalDirectory : public Directory {
 public:
-  LocalDirectory(const std::string &directory_name);
+  // creates the directory, or opens an existing one if create is false
+  LocalDirectory(const std::string &directory_name, bool create = true);
   ~LocalDirectory() override;
-  void create_file(const std::string &filename) override;
-  void write_file(const std::string &filename,
-                  const std::string &content) override;
+  // pwrite and pread on the file
+  std::unique_ptr<IndexOutput>
+  create_output(const std::string &filename) override;
+  std::unique_ptr<IndexInput>
+  open_input(const std::string &filename) override;
+  std::vector<std::string> list_files() override;
+  void delete_file(const std::string &filename) override;
+  // fsync of every file, then of the directory for sync_metadata
+  void sync(const std::vector<std::string> &filenames) override;
+  void rename_file(const std::string &from, const std::string &to) override;
+  void sync_metadata() override;
+  std::unique_ptr<MappedFile> map_file(const std::string &filename) override;
+};
+/*
+ * RAMFile is the content of a file of a RAMDirectory: one buffer from
+ * malloc, grown with realloc, which moves a large buffer by remapping its
+ * pages instead of copying them.
+ */
+class RAMFile {
+  char *buffer;
+  std::size_t length;
+  std::size_t capacity;
+
+public:
+  RAMFile();
+  RAMFile(const char *data, std::size_t length);
+  RAMFile(const RAMFile &) = delete;
+  RAMFile &operator=(const RAMFile &) = delete;
+  ~RAMFile();
+  void append(const void *data, std::size_t length);
+  const char *data() const { return buffer; }
+  std::size_t size() const { return length; }
+};
+/*
+ * RAMDirectory keeps every file in one contiguous buffer in memory, for
+ * tests and benchmarks without filesystem noise and for small indexes
+ * kept whole in memory. map_file() views the buffer without copying it.
+ * A file being written is empty until its output is closed; a deleted or
+ * replaced file stays readable through the MappedFiles already open on
+ * it, as an unlinked file does. sync() and sync_metadata() have nothing
+ * to make durable.
+ */
+class RAMDirectory : public Directory {
+  friend class RAMIndexOutput;
+  mutable std::mutex files_lock;
+  std::map<std::string, std::shared_ptr<const RAMFile>> files;
+  // replaces or creates filename with content
+  void put_file(const std::string &filename,
+                std::shared_ptr<const RAMFile> content);
+
+public:
+  RAMDirectory();
+  // a copy of every file of source, e.g. to serve an index from memory
+  RAMDirectory(Directory *source);
+  ~RAMDirectory() override;
+  std::unique_ptr<IndexOutput>
+  create_output(const std::string &filename) override;
+  std::unique_ptr<IndexInput>
+  open_input(const std::string &filename) override;
+  std::vector<std::string> list_files() override;
+  void delete_file(const std::string &filename) override;
+  void sync(const std::vector<std::string> &filenames) override;
+  void rename_file(const std::string &from, const std::string &to) override;
+  void sync_metadata() override;
+  std::unique_ptr<MappedFile> map_file(const std::string &filename) override;
+  // content of filename, now; throws if there is none
+  std::shared_ptr<const RAMFile> get_file(const std::string &filename) const;
+  // bytes of all the files
+  std::size_t size_in_bytes() const;
 };
 
 /*
@@ -68,6 +163,8 @@ FieldType string_to_field_type(const std::string &str);
  * A Field is a collection of terms.
  * Has three attributes: name(String), fieldsData(BytesRef) and
  * type(FieldType)
+ * Words are views into the document's content buffer, see Document, and
+ * the list of them is allocated from the document's memory resource.
  * https://yqintl.alicdn.com/a1fd591caabf7d52183ddd58239c571292419ad2.png
  */
 class Field {
@@ -75,14 +172,20 @@ class Field {
   FieldType type;
   // note: put here for future use
   std::vector<Paragraph> paragraphs;
-  std::vector<std::string> words;
+  std::pmr::vector<std::string_view> words;
 
 public:
   std::string name;
-  Field(std::string name, FieldType type, const std::string &value);
+  Field(std::string name, FieldType type, const std::string &value,
+        std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+  Field(const Field &) = default;
+  Field(Field &&) = default;
+  Field &operator=(const Field &) = default;
+  Field &operator=(Field &&) = default;
   ~Field();
-  void add_word(const std::string &word);
-  const std::vector<std::string> &get_words() const;
+  void add_word(std::string_view word);
+  void reserve_words(std::size_t count);
+  const std::pmr::vector<std::string_view> &get_words() const;
   void add_subfield(const std::string &name, const std::string &value);
 };
 
@@ -104,18 +207,26 @@ public:
 /*
  * A Document is a collection of fields.
  * A field is a collection of terms.
+ * Ownership: the words of every field point into `content`, which the
+ * caller owns. `content` must stay alive and unmodified until
+ * IndexWriter::add_document has returned for this document. Fields and
+ * their word lists are allocated from `resource`, usually a per-document
+ * Arena, which may be reset once the document has been added. The parser is
+ * only read by the constructor and may then be reset for another document.
  */
 class Document {
   docid_t docid;
   // note: only for now
   HtmlParser *parser;
 
-  char *content;
+  const char *content;
   size_t content_size;
 
 public:
-  std::vector<Field> fields;
-  Document(HtmlParser *parser, char *content, size_t content_size);
+  std::pmr::vector<Field> fields;
+  Document(HtmlParser *parser, const char *content, size_t content_size,
+           std::pmr::memory_resource *resource =
+               std::pmr::get_default_resource());
   ~Document();
   void update_docid(const docid_t &docid);
   const docid_t &get_docid() const;
@@ -129,13 +240,52 @@ public:
  */
 class SegmentInfos {
   segment_id_t segment_id;
-  // std::string segment_name;
-  Directory *directory;
+  std::string segment_name;
+  Directory *directory; // not owned, the index directory
+  docid_t doc_count;
+  std::vector<std::string> files;
 
 public:
-  SegmentInfos(const std::string &name, segment_id_t segment_id);
+  SegmentInfos(const std::string &name, segment_id_t segment_id,
+               Directory *directory);
   ~SegmentInfos();
   void addFile(const std::string &filename);
+  void set_doc_count(const docid_t &doc_count);
+  const std::string &get_name() const;
+  const segment_id_t &get_segment_id() const;
+  const docid_t &get_doc_count() const;
+  const std::vector<std::string> &get_files() const;
+  // from the file names, <segment>.<field>.<extension>, sorted
+  std::vector<std::string> get_field_names() const;
+};
+
+/*
+ * SegmentsFile reads and writes segments_<generation>, the list of the
+ * segments of one commit of the index. A commit writes the next
+ * generation as pending_segments_<generation>, syncs it and renames it
+ * into place, so readers find it whole or not at all, and open the highest
+ * generation. Numbers are VInts:
+ *   "TLSG" version generation segment_count
+ *   per segment: segment_id doc_count file_count,
+ *     then per file: name_length name
+ *   footer (see store.h)
+ * Segment names are _<segment_id>.
+ */
+class SegmentsFile {
+public:
+  static constexpr const char *Magic = "TLSG";
+  static constexpr uint64_t Version = 2;
+
+  static std::string file_name(uint64_t generation);
+  // highest generation of the segments_<generation> among filenames, 0 if
+  // there is none
+  static uint64_t latest_generation(const std::vector<std::string> &filenames);
+  // publishes the commit; the segments' files must be synced already
+  static void write(Directory *directory, uint64_t generation,
+                    const std::vector<SegmentInfos> &segments);
+  // throws if the file is not whole
+  static std::vector<SegmentInfos> read(Directory *directory,
+                                        uint64_t generation);
 };
 
 // Index Building
@@ -190,73 +340,263 @@ public:
   void analyze();
   const std::vector<Term> &get_terms() const;
 };
+/*
+ * TermDictionary is the in-memory inverted index of one field.
+ * Terms are interned to dense ids by a TermsHash; the postings of each term
+ * are two byte streams in a ByteBlockPool shared by all terms:
+ *   docs:      VInt docid delta, VInt freq, ...
+ *   positions: VInt position delta (from 0 in every doc), ...
+ * plus a few fixed size entries per term in parallel arrays. The freq of
+ * the last doc of a term is only written once the term shows up in another
+ * doc, until then it is kept in term_freqs. Docids must be added in
+ * increasing order and positions in increasing order within a doc.
+ */
 class TermDictionary {
   // todo: term->field
-  std::unordered_map<std::string,
-                     std::unordered_map<docid_t, std::vector<term_id_t>>>
-      term_dictionary;
+  TermsHash terms;
+  ByteBlockPool postings;
+  // per term id
+  std::vector<uint32_t> doc_starts;
+  std::vector<uint32_t> doc_uptos;
+  std::vector<uint32_t> position_starts;
+  std::vector<uint32_t> position_uptos;
+  std::vector<docid_t> last_docids;
+  std::vector<term_id_t> last_positions;
+  std::vector<uint32_t> term_freqs; // positions in the last doc
+  std::vector<uint32_t> doc_freqs;
+  // per doc with the field, by docid: its number of terms
+  std::vector<docid_t> length_docids;
+  std::vector<uint32_t> lengths;
 
 public:
   TermDictionary();
   ~TermDictionary() = default;
-  void add_term(const std::string &term, const docid_t &docid,
+  TermDictionary(TermDictionary &&) = default;
+  TermDictionary &operator=(TermDictionary &&) = default;
+  void add_term(std::string_view term, const docid_t &docid,
                 const term_id_t &term_id);
-  const std::vector<term_id_t> &get_term(const std::string &term,
-                                         const docid_t &docid) const;
+  std::vector<term_id_t> get_term(std::string_view term,
+                                  const docid_t &docid) const;
+  std::string_view get_word(std::size_t id) const;
+  // calls visit(docid, positions) for every doc of term id, by docid
+  void read_postings(std::size_t id,
+                     const std::function<void(const docid_t &,
+                                              const std::vector<term_id_t> &)>
+                         &visit) const;
   void print() const;
-  std::string to_string() const;
+  // the text form of TextCodec, a line at a time
+  void write_to(IndexOutput &output) const;
+  std::size_t size() const;
+  std::size_t bytes_used() const;
+  const std::vector<docid_t> &get_length_docids() const;
+  const std::vector<uint32_t> &get_lengths() const;
 };
-// Index Querying
 
 /*
- * Query is a collection of terms.
+ * A SegmentWriter is the in-memory segment of one indexing thread.
+ * It owns a TermDictionary per field and is only used by one thread at a
+ * time, so inverting needs no locking. Each SegmentWriter is flushed on its
+ * own as one segment.
  */
-class Query {
+class SegmentWriter {
+  segment_id_t segment_id;
+  std::unordered_map<std::string, TermDictionary>
+      term_dictionaries; // per field dictionary of terms
+  docid_t doc_count;
+  // bytes_used() as of the last finish_document(), readable from any thread
+  std::atomic<std::size_t> ram_bytes;
+
 public:
-  Query(const std::string &query);
-  ~Query();
-  void add_word(const std::string &word);
+  SegmentWriter(segment_id_t segment_id);
+  ~SegmentWriter();
+  // positions holds, per field, the position of its next word in document
+  void invert(const Document &document,
+              std::unordered_map<std::string, term_id_t> &positions);
+  void finish_document();
+  const segment_id_t &get_segment_id() const;
+  const docid_t &get_doc_count() const;
+  // memory held by the term dictionaries: their pools and per term arrays
+  std::size_t bytes_used() const;
+  std::size_t get_ram_bytes() const { return ram_bytes; }
+  std::unordered_map<std::string, TermDictionary> &get_term_dictionaries();
 };
+// Index Reading, see reader.h and query.h
+
+class FieldReader;
+
 /*
- * Codec is used to encode and decode the segment to and from a string.
+ * Codec is used to encode and decode the segment to and from the files of
+ * the index directory. The formats are in codec.h.
  */
-// todo: inheritance
 class Codec {
 public:
   Codec();
-  ~Codec();
-  void encode_term_dictionarie(
-      Directory *directory,
-      std::unordered_map<std::string, TermDictionary> &term_dictionaries);
-  void decode_term_dictionary(Directory *directory, std::string &filename);
+  virtual ~Codec();
+  // writes the segment's files and returns their names
+  virtual std::vector<std::string> encode_term_dictionarie(
+      Directory *directory, const std::string &segment_name,
+      std::unordered_map<std::string, TermDictionary> &term_dictionaries) = 0;
+  // opens the files of one field of a segment for reading
+  virtual std::unique_ptr<FieldReader>
+  decode_term_dictionary(Directory *directory, const std::string &segment_name,
+                         const std::string &field_name) = 0;
+  // writes segment_name from the files of segments, which are left as
+  // they are, and returns the names of its files
+  virtual std::vector<std::string>
+  merge_segments(Directory *directory, const std::string &segment_name,
+                 const std::vector<SegmentInfos> &segments) = 0;
+};
+
+/*
+ * MergePolicy picks which segments of the index to merge into one, so that
+ * the number of segments a query visits stays small as segments are
+ * flushed.
+ */
+class MergePolicy {
+public:
+  MergePolicy();
+  virtual ~MergePolicy();
+  // positions in segments of the ones to merge next, empty if none
+  virtual std::vector<std::size_t>
+  find_merge(const std::vector<SegmentInfos> &segments) const = 0;
+};
+
+/*
+ * TieredMergePolicy, after Lucene's: a segment's size is its doc count,
+ * floor_docs for smaller ones. From the smallest segment up, every tier may
+ * hold segments_per_tier segments, each tier's segments being
+ * max_merge_at_once times the size of the previous tier's. While there are
+ * more segments than that, it merges up to max_merge_at_once of them,
+ * adjacent by size, picking the least skewed merge: the one whose largest
+ * segment is the smallest share of the total. Segments of more than half
+ * max_merged_docs are not merged again.
+ */
+class TieredMergePolicy : public MergePolicy {
+  std::size_t max_merge_at_once;
+  std::size_t segments_per_tier;
+  docid_t floor_docs;
+  docid_t max_merged_docs;
+
+public:
+  TieredMergePolicy(std::size_t max_merge_at_once = 10,
+                    std::size_t segments_per_tier = 10,
+                    docid_t floor_docs = 1000,
+                    docid_t max_merged_docs = 5000000);
+  ~TieredMergePolicy() override;
+  std::vector<std::size_t>
+  find_merge(const std::vector<SegmentInfos> &segments) const override;
 };
 
 class IndexWriterConfig {
 
 public:
   Codec *codec;
-  IndexWriterConfig(Codec *codec);
+  // a segment is handed to the flush thread once it holds this many
+  // documents, 0 for no limit
+  docid_t max_buffered_docs;
+  // or once the in-memory segments take more than this many MB together,
+  // 0 for no limit; with neither limit segments stay in memory until
+  // flush()
+  double ram_buffer_size_mb;
+  // full segments that may wait for the flush thread before add_document
+  // blocks
+  std::size_t max_pending_flushes;
+  // not owned, nullptr never merges; the codec must be able to merge
+  MergePolicy *merge_policy;
+  IndexWriterConfig(Codec *codec, docid_t max_buffered_docs = 0,
+                    double ram_buffer_size_mb = 0,
+                    std::size_t max_pending_flushes = 4,
+                    MergePolicy *merge_policy = nullptr);
   ~IndexWriterConfig();
 };
 /*
  * IndexWriter is high level interface to add documents to the index.
  * IndexWriter -> Codec -> SegmentInfos (point to dir)
  * https://yqintl.alicdn.com/9a0952dbcf349d96d1c85181c38d6b173be02be5.png
+ *
+ * add_document may be called from several threads at once. Each call takes
+ * an idle SegmentWriter (or creates one), so N threads invert into N private
+ * in-memory segments; only taking and returning a SegmentWriter is locked.
+ * Docids are assigned atomically, are unique across segments and increase
+ * within each segment.
+ * flush() must not run concurrently with add_document.
+ *
+ * Segments are written by a background flush thread: a SegmentWriter that
+ * reaches max_buffered_docs is queued for it while indexing continues in a
+ * fresh segment. So is, when the in-memory segments together outgrow
+ * ram_buffer_size_mb, the largest of them, once no thread is using it.
+ * When too many segments wait, add_document blocks.
+ *
+ * Written segments are immutable. After every flush a background merge
+ * thread asks the merge policy for segments to merge, writes them as one
+ * new segment, with the next segment number, and then deletes their files.
+ * Merging only takes the lock to pick segments and to swap them for the
+ * merged one, so it never holds up add_document or the flush thread.
+ *
+ * Readers only see what commit() publishes, see SegmentsFile. The files of
+ * the last commit, and of one being written, are kept even once merged
+ * away; the commit that stops referencing them deletes them. The
+ * destructor waits for the merges the policy still asks for, then deletes
+ * the files no commit references, leaving the index as last committed. The
+ * index directory is expected to start empty.
  */
 class IndexWriter {
   Directory *index_dir;
   IndexWriterConfig *config;
-  // todo: add attributes for content to write
-  std::unordered_map<std::string, TermDictionary>
-      term_dictionaries; // per field dictionary of terms
-  std::vector<SegmentInfos> segment_infos;
-  std::vector<Document> documents;
-  docid_t docid; // current docid
+  std::size_t ram_budget; // bytes, 0 for none
+  std::mutex segments_lock; // guards the members below
+  std::vector<std::unique_ptr<SegmentWriter>> segment_writers; // all, in use or not
+  std::vector<SegmentWriter *> idle_segment_writers;
+  SegmentWriter *flush_pending; // in use, to flush once returned
+  segment_id_t next_segment_id;
+  std::vector<SegmentInfos> segment_infos; // written segments
+  bool closing;
+  bool merging; // a merge is being written
+  std::condition_variable merge_cond; // a segment was written, or closing
+  std::condition_variable merges_done; // the merge thread went idle
+  std::condition_variable flushes_done; // pending_flushes dropped to 0
+  std::atomic<docid_t> docid; // next docid
+  BoundedQueue<std::unique_ptr<SegmentWriter>> flush_queue;
+  // queued or being written, decremented under segments_lock
+  std::atomic<std::size_t> pending_flushes;
+  StageStats flush_stats;
+  std::thread flush_thread;
+  StageStats merge_stats;
+  std::thread merge_thread;
+  std::mutex commit_lock; // one commit at a time, guards synced_files
+  uint64_t generation;    // of the last commit, 0 before the first
+  std::vector<std::string> committed_files; // of the last commit
+  // per file, the commits referencing it among the last one and the one
+  // being written, guarded by segments_lock
+  std::unordered_map<std::string, std::size_t> commit_refs;
+  std::unordered_set<std::string> synced_files;
+  SegmentWriter *acquire_segment_writer();
+  void release_segment_writer(SegmentWriter *segment_writer);
+  void flush_segment(SegmentWriter &segment_writer);
+  void queue_flush(std::unique_ptr<SegmentWriter> segment_writer);
+  void flush_loop();
+  void merge_loop();
+  // commits the written segments
+  void publish();
 
 public:
   IndexWriter(IndexWriterConfig *config, Directory *index_dir);
   ~IndexWriter();
   void add_document(Document &document);
+  void add_document(HtmlParser &parser,
+                    const std::function<std::string_view()> &next_chunk);
+  /*
+   * Flushes, then makes the written segments durable and visible to
+   * readers: syncs the files no commit has synced yet, publishes the next
+   * segments_<generation> and deletes the files the previous commit alone
+   * kept. Must not run while documents are being added.
+   */
   void commit();
   void flush();
+  // blocks until the merge policy has nothing left to merge; commit() then
+  // publishes the merged segments
+  void wait_for_merges();
+  const StageStats &get_flush_stats() const;
+  const StageStats &get_merge_stats() const;
+  const BoundedQueue<std::unique_ptr<SegmentWriter>> &get_flush_queue() const;
 };
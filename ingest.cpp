@@ -0,0 +1,104 @@
+#include "ingest.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * MappedFile constructor
+ */
+MappedFile::MappedFile(const std::string &path, bool sequential)
+    : content(nullptr), content_size(0) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("Failed to stat " + path);
+  }
+  content_size = st.st_size;
+  if (content_size == 0) {
+    // mmap rejects empty mappings, an empty file is just an empty document
+    close(fd);
+    return;
+  }
+  void *mapped = mmap(nullptr, content_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping holds its own reference to the file
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Failed to map " + path);
+  }
+  content = static_cast<char *>(mapped);
+  if (sequential) {
+    madvise(content, content_size, MADV_SEQUENTIAL);
+  }
+}
+/*
+ * MappedFile constructor, viewing data
+ */
+MappedFile::MappedFile(const char *data, size_t size,
+                       std::shared_ptr<const void> owner)
+    : content(const_cast<char *>(data)), content_size(size),
+      owner(std::move(owner)) {}
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : content(other.content), content_size(other.content_size),
+      owner(std::move(other.owner)) {
+  other.content = nullptr;
+  other.content_size = 0;
+}
+/*
+ * MappedFile destructor
+ */
+MappedFile::~MappedFile() {
+  if (content && !owner) {
+    munmap(content, content_size);
+  }
+}
+const char *MappedFile::data() const { return content; }
+size_t MappedFile::size() const { return content_size; }
+/*
+ * Start reading the whole file in the background, so that the page faults
+ * of the parser find the pages already cached.
+ */
+void MappedFile::prefetch() const {
+  if (content && !owner) {
+    madvise(content, content_size, MADV_WILLNEED);
+  }
+}
+
+std::vector<std::string> list_corpus(const std::vector<std::string> &inputs) {
+  std::vector<std::string> files;
+  for (const auto &input : inputs) {
+    if (!input.empty() && input[0] == '@') {
+      std::ifstream list(input.substr(1));
+      if (!list.is_open()) {
+        throw std::runtime_error("Failed to open file list " + input.substr(1));
+      }
+      for (std::string line; std::getline(list, line);) {
+        if (!line.empty()) {
+          files.push_back(line);
+        }
+      }
+    } else if (std::filesystem::is_directory(input)) {
+      std::vector<std::string> found;
+      for (const auto &entry :
+           std::filesystem::recursive_directory_iterator(input)) {
+        if (entry.is_regular_file()) {
+          found.push_back(entry.path().string());
+        }
+      }
+      // directory order is arbitrary, sort to keep docids reproducible
+      std::sort(found.begin(), found.end());
+      files.insert(files.end(), found.begin(), found.end());
+    } else {
+      files.push_back(input);
+    }
+  }
+  return files;
+}
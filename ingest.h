@@ -0,0 +1,41 @@
+// corpus ingestion
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * A read-only memory mapping of a whole file, unmapped when the object is
+ * destroyed, so a MappedFile should live exactly as long as the document
+ * parsed from it (see Document) or the reader using it (see IndexReader).
+ * Documents are read once front to back and advised as sequential; index
+ * files are read where lookups land and keep the kernel's default.
+ * The file is closed once mapped, so open mappings take no descriptors.
+ * A MappedFile can also view bytes already in memory, keeping their owner
+ * alive instead of mapping anything (see RAMDirectory).
+ */
+class MappedFile {
+  char *content;
+  size_t content_size;
+  std::shared_ptr<const void> owner; // of the viewed bytes, if not mapped
+
+public:
+  MappedFile(const std::string &path, bool sequential = true);
+  MappedFile(const char *data, size_t size, std::shared_ptr<const void> owner);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&other) noexcept;
+  ~MappedFile();
+  const char *data() const;
+  size_t size() const;
+  void prefetch() const;
+};
+
+/*
+ * Expand command line inputs into the list of files to index.
+ * An input is a file, a directory (every regular file below it, in path
+ * order) or "@list" (one path per line in the file list).
+ */
+std::vector<std::string> list_corpus(const std::vector<std::string> &inputs);
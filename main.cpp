@@ -1,42 +1,90 @@
+#include "async_io.h"
+#include "codec.h"
 #include "index.h"
+#include "ingest.h"
+#include "pipeline.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
-char *ReadFile(const char *filename, size_t &fileSize) {
-  // Read the file into memory.
-  // You'll soon learn a much more efficient way to do this.
+// Size of the buffer a document read from stdin is streamed through.
+const size_t ChunkSize = 64 * 1024;
+// Memory the in-memory segments may take before one is handed to the flush
+// thread.
+const double RamBufferSizeMB = 16;
 
-  // Attempt to Create an istream and seek to the end
-  // to get the size.
-  std::ifstream ifs(filename, std::ios::ate | std::ios::binary);
-  if (!ifs.is_open())
-    return nullptr;
-  fileSize = ifs.tellg();
-
-  // Allocate a block of memory big enough to hold it.
-  char *buffer = new char[fileSize];
-
-  // Seek back to the beginning of the file, read it into
-  // the buffer, then return the buffer.
-  ifs.seekg(0);
-  ifs.read(buffer, fileSize);
-  return buffer;
+/*
+ * Index a document read from stdin, which cannot be mapped, one chunk at a
+ * time.
+ */
+void index_stdin(IndexWriter &index_writer) {
+  std::vector<char> chunk(ChunkSize);
+  auto next_chunk = [&]() {
+    std::cin.read(chunk.data(), chunk.size());
+    return std::string_view(chunk.data(), std::cin.gcount());
+  };
+  HtmlParser html_parser;
+  index_writer.add_document(html_parser, next_chunk);
 }
+
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    std::cerr << "Usage: " << argv[0] << " <index_dir>" << std::endl;
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::string format = "binary";
+  std::string directory = "local";
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1]; arg += 2) {
+    std::string option = argv[arg];
+    if (option == "-j") {
+      num_threads = std::max(1, std::stoi(argv[arg + 1]));
+    } else if (option == "-f") {
+      format = argv[arg + 1];
+    } else if (option == "-d") {
+      directory = argv[arg + 1];
+    } else {
+      break;
+    }
+  }
+  if (argc - arg < 1 || (format != "binary" && format != "text") ||
+      (directory != "local" && directory != "async")) {
+    std::cerr << "Usage: " << argv[0]
+              << " [-j threads] [-f binary|text] [-d local|async] <index_dir>"
+                 " [file | directory | @file_list | -]..."
+              << std::endl;
     return 1;
   }
-  std::string index_dir = argv[1];
-  size_t fileSize;
-  char *buffer = ReadFile("NYTimes.html", fileSize);
-  HtmlParser *html_parser = new HtmlParser(buffer, fileSize);
-  IndexWriterConfig index_writer_config(new Codec());
-  IndexWriter index_writer(&index_writer_config, new LocalDirectory(index_dir));
-  Document nytimes_document(html_parser, buffer, fileSize);
-  index_writer.add_document(nytimes_document);
+  std::string index_dir = argv[arg];
+  std::vector<std::string> inputs(argv + arg + 1, argv + argc);
+  if (inputs.empty()) {
+    inputs.push_back("NYTimes.html");
+  }
+  bool from_stdin = inputs.size() == 1 && inputs[0] == "-";
+  Codec *codec = format == "text" ? (Codec *)new TextCodec()
+                                   : (Codec *)new BinaryCodec();
+  // text segments cannot be read back, so they are not merged
+  TieredMergePolicy merge_policy;
+  IndexWriterConfig index_writer_config(
+      codec, 0, RamBufferSizeMB, 4,
+      format == "text" ? nullptr : &merge_policy);
+  Directory *index_directory = directory == "async"
+                                   ? new AsyncDirectory(index_dir)
+                                   : new LocalDirectory(index_dir);
+  IndexWriter index_writer(&index_writer_config, index_directory);
+  if (from_stdin) {
+    index_stdin(index_writer);
+  } else {
+    // parsing and inverting each get num_threads threads
+    IngestPipeline pipeline(&index_writer, num_threads, num_threads);
+    pipeline.run(list_corpus(inputs));
+    pipeline.report(std::cout);
+  }
+  // one commit, with the merges the last flushes call for
   index_writer.flush();
+  index_writer.wait_for_merges();
+  index_writer.commit();
   return 0;
-}
\ No newline at end of file
+}
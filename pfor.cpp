@@ -0,0 +1,74 @@
+#include "pfor.h"
+#include <algorithm>
+#include <cstring>
+
+// Most values a block may patch.
+static constexpr int MaxExceptions = 7;
+
+void write_vint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((char)value);
+}
+
+void pfor_encode(const uint32_t *values, std::string &out) {
+  // counts[b]: values that need exactly b bits
+  int max_bits = 0;
+  int counts[33] = {};
+  for (std::size_t i = 0; i < PostingsBlockSize; ++i) {
+    int bits = bits_required(values[i]);
+    max_bits = std::max(max_bits, bits);
+    counts[bits]++;
+  }
+  // cheapest width whose exceptions fit: high bits of an exception are one
+  // byte, so at most 8 bits can be patched
+  int best_bits = max_bits;
+  int exceptions = 0;
+  std::size_t best_size = PostingsBlockSize * max_bits / 8;
+  for (int bits = max_bits - 1, above = counts[max_bits];
+       bits >= std::max(0, max_bits - 8) && above <= MaxExceptions;
+       above += counts[bits--]) {
+    std::size_t size = PostingsBlockSize * bits / 8 + 2 * above;
+    if (size < best_size) {
+      best_size = size;
+      best_bits = bits;
+      exceptions = above;
+    }
+  }
+  out.push_back((char)best_bits);
+  out.push_back((char)exceptions);
+  uint32_t low[PostingsBlockSize];
+  uint32_t mask = best_bits == 32 ? ~0u : (1u << best_bits) - 1;
+  for (std::size_t i = 0; i < PostingsBlockSize; ++i) {
+    low[i] = values[i] & mask;
+  }
+  std::size_t packed = out.size();
+  out.resize(packed + PostingsBlockSize * best_bits / 8);
+  pack_bits(low, best_bits, (uint8_t *)&out[packed]);
+  if (exceptions > 0) {
+    for (std::size_t i = 0; i < PostingsBlockSize; ++i) {
+      if (values[i] > mask) {
+        out.push_back((char)i);
+        out.push_back((char)(values[i] >> best_bits));
+      }
+    }
+  }
+}
+
+const uint8_t *pfor_decode(const uint8_t *in, uint32_t *values) {
+  int bits = in[0];
+  int exceptions = in[1];
+  in += 2;
+  unpack_bits(in, bits, values);
+  in += PostingsBlockSize * bits / 8;
+  for (int i = 0; i < exceptions; ++i, in += 2) {
+    values[in[0]] |= (uint32_t)in[1] << bits;
+  }
+  return in;
+}
+
+const uint8_t *pfor_skip(const uint8_t *in) {
+  return in + 2 + PostingsBlockSize * in[0] / 8 + 2 * in[1];
+}
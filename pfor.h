@@ -0,0 +1,44 @@
+// integer compression for postings: VInt and patched frame of reference
+#pragma once
+
+#include "bitpacking.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * VInt: 7 bits per byte, least significant group first, high bit set on
+ * every byte but the last.
+ */
+void write_vint(std::string &out, uint64_t value);
+// inline, readers call it for every term and every tail posting
+inline uint64_t read_vint(const uint8_t *&in) {
+  uint64_t value = *in++;
+  if (value < 0x80) {
+    return value;
+  }
+  value &= 0x7f;
+  for (int shift = 7;; shift += 7) {
+    uint8_t byte = *in++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+}
+
+/*
+ * PFOR (patched frame of reference) block of PostingsBlockSize values:
+ *   byte  bits, the width every value is packed with
+ *   byte  number of exceptions, at most 7
+ *   bytes the values packed with pack_bits (bitpacking.h), low `bits`
+ *         bits only
+ *   per exception: byte index, byte high bits (value >> bits)
+ * The width is chosen so that the 8 largest values may not fit and are
+ * patched afterwards, so a few large gaps do not widen the whole block.
+ */
+void pfor_encode(const uint32_t *values, std::string &out);
+// decodes one block into values and returns the first byte after it
+const uint8_t *pfor_decode(const uint8_t *in, uint32_t *values);
+// returns the first byte after the block at in without decoding it
+const uint8_t *pfor_skip(const uint8_t *in);
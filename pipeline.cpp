@@ -0,0 +1,162 @@
+#include "pipeline.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+// Largest arena kept for reuse by the next document.
+static constexpr std::size_t MaxRecycledArenaBytes = 4 * 1024 * 1024;
+
+/*
+ * IngestPipeline constructor
+ */
+IngestPipeline::IngestPipeline(IndexWriter *index_writer,
+                               std::size_t parse_threads,
+                               std::size_t invert_threads,
+                               std::size_t queue_capacity)
+    : index_writer(index_writer), parse_threads(parse_threads),
+      invert_threads(invert_threads), read_queue(queue_capacity),
+      parse_queue(queue_capacity),
+      free_arenas(2 * queue_capacity + parse_threads + invert_threads),
+      elapsed_seconds(0) {}
+/*
+ * IngestPipeline destructor
+ */
+IngestPipeline::~IngestPipeline() = default;
+
+/*
+ * Read stage: map each file and start reading it ahead of the parser.
+ */
+void IngestPipeline::read(const std::vector<std::string> &paths) {
+  for (const auto &path : paths) {
+    uint64_t start = StageStats::now_ns();
+    auto item = std::make_unique<IngestItem>();
+    item->path = path;
+    try {
+      item->file = std::make_unique<MappedFile>(path);
+      item->file->prefetch();
+    } catch (const std::runtime_error &e) {
+      std::cerr << "Skipping " << path << ": " << e.what() << std::endl;
+      continue;
+    }
+    read_stats.busy_ns += StageStats::now_ns() - start;
+    read_stats.items++;
+    read_queue.push(std::move(item), &read_stats);
+  }
+}
+
+/*
+ * Parse stage: tokenize the mapping into a Document. The Document copies
+ * the tokens into the arena, so the thread's parser is free for the next
+ * file as soon as it is built.
+ */
+void IngestPipeline::parse() {
+  std::unique_ptr<HtmlParser> html_parser = parsers.acquire();
+  std::unique_ptr<IngestItem> item;
+  while (read_queue.pop(item, &parse_stats)) {
+    uint64_t start = StageStats::now_ns();
+    if (!free_arenas.try_pop(item->arena)) {
+      item->arena = std::make_unique<Arena>();
+    }
+    html_parser->reset(item->file->data(), item->file->size());
+    item->document = std::make_unique<Document>(
+        html_parser.get(), item->file->data(), item->file->size(),
+        item->arena.get());
+    parse_stats.busy_ns += StageStats::now_ns() - start;
+    parse_stats.items++;
+    parse_queue.push(std::move(item), &parse_stats);
+  }
+  parsers.release(std::move(html_parser));
+}
+
+/*
+ * Invert stage: add the document to the index, recycle the arena, then drop
+ * the item, which unmaps the file.
+ */
+void IngestPipeline::invert() {
+  std::unique_ptr<IngestItem> item;
+  while (parse_queue.pop(item, &invert_stats)) {
+    uint64_t start = StageStats::now_ns();
+    index_writer->add_document(*item->document);
+    item->document.reset();
+    item->arena->reset();
+    // an arena grown by a huge document is freed instead of kept around
+    if (item->arena->get_capacity() <= MaxRecycledArenaBytes) {
+      free_arenas.try_push(item->arena);
+    }
+    item.reset();
+    invert_stats.busy_ns += StageStats::now_ns() - start;
+    invert_stats.items++;
+  }
+}
+
+/*
+ * Run every stage until all paths are inverted. Segments still in memory
+ * are left for IndexWriter::flush().
+ */
+void IngestPipeline::run(const std::vector<std::string> &paths) {
+  auto started = std::chrono::steady_clock::now();
+  std::thread reader(&IngestPipeline::read, this, std::cref(paths));
+  std::vector<std::thread> parsers;
+  for (std::size_t i = 0; i < parse_threads; ++i) {
+    parsers.emplace_back(&IngestPipeline::parse, this);
+  }
+  std::vector<std::thread> inverters;
+  for (std::size_t i = 0; i < invert_threads; ++i) {
+    inverters.emplace_back(&IngestPipeline::invert, this);
+  }
+  // a queue is closed once every thread feeding it is done
+  reader.join();
+  read_queue.close();
+  for (auto &thread : parsers) {
+    thread.join();
+  }
+  parse_queue.close();
+  for (auto &thread : inverters) {
+    thread.join();
+  }
+  elapsed_seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - started)
+                        .count();
+}
+
+void IngestPipeline::report(std::ostream &out) const {
+  auto stage = [&](const char *name, const StageStats &stats,
+                   std::size_t threads) {
+    // shares of the time the stage's threads were alive
+    double total = elapsed_seconds * 1e9 * threads;
+    char line[160];
+    snprintf(line, sizeof(line),
+             "%-7s threads=%zu items=%llu busy=%5.1f%% starved=%5.1f%% "
+             "blocked=%5.1f%%",
+             name, threads, (unsigned long long)stats.items.load(),
+             total > 0 ? 100.0 * stats.busy_ns.load() / total : 0.0,
+             total > 0 ? 100.0 * stats.starved_ns.load() / total : 0.0,
+             total > 0 ? 100.0 * stats.blocked_ns.load() / total : 0.0);
+    out << line << "\n";
+  };
+  auto queue = [&](const char *name, double occupancy, std::size_t capacity,
+                   uint64_t full_pushes) {
+    char line[160];
+    snprintf(line, sizeof(line),
+             "  queue %-13s capacity=%zu avg occupancy=%5.1f%% full=%llu",
+             name, capacity, 100.0 * occupancy,
+             (unsigned long long)full_pushes);
+    out << line << "\n";
+  };
+  out << "Pipeline: " << elapsed_seconds << " s\n";
+  stage("read", read_stats, 1);
+  queue("read->parse", read_queue.average_occupancy(), read_queue.capacity(),
+        read_queue.get_full_pushes());
+  stage("parse", parse_stats, parse_threads);
+  queue("parse->invert", parse_queue.average_occupancy(),
+        parse_queue.capacity(), parse_queue.get_full_pushes());
+  stage("invert", invert_stats, invert_threads);
+  const auto &flush_queue = index_writer->get_flush_queue();
+  queue("invert->flush", flush_queue.average_occupancy(),
+        flush_queue.capacity(), flush_queue.get_full_pushes());
+  stage("flush", index_writer->get_flush_stats(), 1);
+  // merges still running carry on after the pipeline
+  stage("merge", index_writer->get_merge_stats(), 1);
+}
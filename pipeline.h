@@ -0,0 +1,64 @@
+// staged ingest pipeline
+#pragma once
+
+#include "index.h"
+#include "ingest.h"
+#include "queue.h"
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * One input file on its way through the pipeline. The document's words
+ * point into the mapping and its fields live in the arena, so all three
+ * travel together; the file is unmapped after inversion and the arena is
+ * reset and recycled.
+ */
+struct IngestItem {
+  std::string path;
+  std::unique_ptr<MappedFile> file;
+  std::unique_ptr<Arena> arena;
+  std::unique_ptr<Document> document;
+};
+
+/*
+ * IngestPipeline indexes a list of files in overlapping stages:
+ *   read (map + prefetch) -> parse -> invert -> flush
+ * Stages are connected by bounded lock-free queues. A full queue blocks the
+ * stage in front of it, so a slow stage holds back the others instead of
+ * letting mapped files pile up. The flush stage is IndexWriter's background
+ * flush thread. report() prints, per stage, how its time split between
+ * working, waiting for input and waiting on the next stage, and how full
+ * each queue was; the stage with the highest busy share is the bottleneck.
+ * Each document is parsed into its own Arena, which goes back to the parse
+ * stage once the document is inverted, so memory stays flat over a corpus.
+ * Every parse thread reuses one HtmlParser from a ParserPool, whose token
+ * vectors keep their capacity: only the Document's fields, copied out of
+ * it, go into the arena.
+ */
+class IngestPipeline {
+  IndexWriter *index_writer;
+  std::size_t parse_threads;
+  std::size_t invert_threads;
+  BoundedQueue<std::unique_ptr<IngestItem>> read_queue;  // read -> parse
+  BoundedQueue<std::unique_ptr<IngestItem>> parse_queue; // parse -> invert
+  BoundedQueue<std::unique_ptr<Arena>> free_arenas; // invert -> parse
+  ParserPool parsers;
+  StageStats read_stats;
+  StageStats parse_stats;
+  StageStats invert_stats;
+  double elapsed_seconds;
+
+  void read(const std::vector<std::string> &paths);
+  void parse();
+  void invert();
+
+public:
+  IngestPipeline(IndexWriter *index_writer, std::size_t parse_threads,
+                 std::size_t invert_threads, std::size_t queue_capacity = 64);
+  ~IngestPipeline();
+  void run(const std::vector<std::string> &paths);
+  void report(std::ostream &out) const;
+};
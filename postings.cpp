@@ -0,0 +1,234 @@
+#include "postings.h"
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+
+// ByteBlockPool
+
+// slice sizes by level, a slice grows to the next level when it fills up
+const uint8_t ByteBlockPool::LevelSize[] = {5, 14, 20, 30, 40,
+                                            40, 80, 80, 120, 200};
+const uint8_t ByteBlockPool::NextLevel[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 9};
+
+/*
+ * ByteBlockPool constructor
+ */
+ByteBlockPool::ByteBlockPool() : used_blocks(0), byte_upto(BlockSize) {}
+/*
+ * ByteBlockPool destructor
+ */
+ByteBlockPool::~ByteBlockPool() = default;
+
+void ByteBlockPool::next_block() {
+  // addresses are 32 bits
+  if (used_blocks == (std::size_t(1) << (32 - BlockShift))) {
+    throw std::length_error("ByteBlockPool is full");
+  }
+  if (used_blocks == blocks.size()) {
+    blocks.emplace_back(new uint8_t[BlockSize]());
+  } else {
+    std::memset(blocks[used_blocks].get(), 0, BlockSize);
+  }
+  ++used_blocks;
+  byte_upto = 0;
+}
+
+void ByteBlockPool::reset() {
+  used_blocks = 0;
+  byte_upto = BlockSize;
+}
+
+uint32_t ByteBlockPool::allocate(uint32_t size) {
+  if (byte_upto + size > BlockSize) {
+    next_block();
+  }
+  uint32_t address = ((uint32_t)(used_blocks - 1) << BlockShift) | byte_upto;
+  byte_upto += size;
+  return address;
+}
+
+uint32_t ByteBlockPool::new_slice() {
+  uint32_t address = allocate(LevelSize[0]);
+  *at(address + LevelSize[0] - 1) = 16; // end marker, level 0
+  return address;
+}
+
+/*
+ * Chain a bigger slice to the full slice ending at marker and return where
+ * writing continues. The forwarding address takes the place of the old
+ * slice's last 3 data bytes, which move to the start of the new slice.
+ */
+uint32_t ByteBlockPool::grow_slice(uint32_t marker) {
+  uint8_t *slice_end = at(marker);
+  int level = NextLevel[*slice_end & 15];
+  uint32_t size = LevelSize[level];
+  uint32_t address = allocate(size);
+  uint8_t *slice = at(address);
+  std::memcpy(slice, slice_end - 3, 3);
+  slice_end[-3] = (uint8_t)address;
+  slice_end[-2] = (uint8_t)(address >> 8);
+  slice_end[-1] = (uint8_t)(address >> 16);
+  slice_end[0] = (uint8_t)(address >> 24);
+  slice[size - 1] = 16 | level;
+  return address + 3;
+}
+
+void ByteBlockPool::write_byte(uint32_t &upto, uint8_t byte) {
+  uint8_t *p = at(upto);
+  if (*p != 0) {
+    // reached the end marker
+    upto = grow_slice(upto);
+    p = at(upto);
+  }
+  *p = byte;
+  ++upto;
+}
+
+void ByteBlockPool::write_vint(uint32_t &upto, uint64_t value) {
+  while (value >= 0x80) {
+    write_byte(upto, (uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  write_byte(upto, (uint8_t)value);
+}
+
+std::size_t ByteBlockPool::bytes_used() const {
+  return blocks.size() * BlockSize;
+}
+
+// ByteSliceReader
+
+/*
+ * ByteSliceReader constructor
+ */
+ByteSliceReader::ByteSliceReader(const ByteBlockPool *pool, uint32_t start,
+                                 uint32_t end)
+    : pool(pool), end(end), level(0) {
+  buffer_offset = start & ~ByteBlockPool::BlockMask;
+  buffer = pool->at(buffer_offset);
+  upto = start & ByteBlockPool::BlockMask;
+  if (start + ByteBlockPool::LevelSize[0] >= end) {
+    limit = end - buffer_offset;
+  } else {
+    limit = upto + ByteBlockPool::LevelSize[0] - 4;
+  }
+}
+
+void ByteSliceReader::next_slice() {
+  const uint8_t *p = buffer + limit;
+  uint32_t next = (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                  (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+  level = ByteBlockPool::NextLevel[level];
+  uint32_t size = ByteBlockPool::LevelSize[level];
+  buffer_offset = next & ~ByteBlockPool::BlockMask;
+  buffer = pool->at(buffer_offset);
+  upto = next & ByteBlockPool::BlockMask;
+  if (next + size >= end) {
+    limit = end - buffer_offset;
+  } else {
+    limit = upto + size - 4;
+  }
+}
+
+uint64_t ByteSliceReader::read_vint() {
+  uint64_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    uint8_t byte = read_byte();
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+}
+
+// TermsHash
+
+static uint32_t hash_term(std::string_view term) {
+  return (uint32_t)std::hash<std::string_view>{}(term);
+}
+
+/*
+ * TermsHash constructor
+ */
+TermsHash::TermsHash() : table(1024, -1) {}
+/*
+ * TermsHash destructor
+ */
+TermsHash::~TermsHash() = default;
+
+void TermsHash::rehash(std::size_t size) {
+  table.assign(size, -1);
+  std::size_t mask = size - 1;
+  for (std::size_t id = 0; id < hashes.size(); ++id) {
+    std::size_t slot = hashes[id] & mask;
+    while (table[slot] != -1) {
+      slot = (slot + 1) & mask;
+    }
+    table[slot] = (int32_t)id;
+  }
+}
+
+int32_t TermsHash::add(std::string_view term, bool &is_new) {
+  is_new = false;
+  if (term.size() > MaxTermLength) {
+    return -1;
+  }
+  uint32_t hash = hash_term(term);
+  std::size_t mask = table.size() - 1;
+  std::size_t slot = hash & mask;
+  for (int32_t id; (id = table[slot]) != -1; slot = (slot + 1) & mask) {
+    if (hashes[id] == hash && get(id) == term) {
+      return id;
+    }
+  }
+  is_new = true;
+  uint32_t address = pool.allocate((uint32_t)term.size() + 2);
+  uint8_t *bytes = pool.at(address);
+  bytes[0] = (uint8_t)term.size();
+  bytes[1] = (uint8_t)(term.size() >> 8);
+  std::memcpy(bytes + 2, term.data(), term.size());
+  int32_t id = (int32_t)starts.size();
+  starts.push_back(address);
+  hashes.push_back(hash);
+  table[slot] = id;
+  // keep the table at most half full
+  if (starts.size() * 2 > table.size()) {
+    rehash(table.size() * 2);
+  }
+  return id;
+}
+
+int32_t TermsHash::find(std::string_view term) const {
+  if (term.size() > MaxTermLength) {
+    return -1;
+  }
+  uint32_t hash = hash_term(term);
+  std::size_t mask = table.size() - 1;
+  for (std::size_t slot = hash & mask; table[slot] != -1;
+       slot = (slot + 1) & mask) {
+    int32_t id = table[slot];
+    if (hashes[id] == hash && get(id) == term) {
+      return id;
+    }
+  }
+  return -1;
+}
+
+std::string_view TermsHash::get(uint32_t id) const {
+  const uint8_t *bytes = pool.at(starts[id]);
+  return std::string_view((const char *)bytes + 2,
+                          (std::size_t)bytes[0] | (std::size_t)bytes[1] << 8);
+}
+
+std::size_t TermsHash::bytes_used() const {
+  return pool.bytes_used() +
+         (starts.capacity() + hashes.capacity() + table.capacity()) *
+             sizeof(uint32_t);
+}
+
+void TermsHash::reset() {
+  pool.reset();
+  starts.clear();
+  hashes.clear();
+  table.assign(1024, -1);
+}
@@ -0,0 +1,117 @@
+// in-memory postings buffer
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/*
+ * ByteBlockPool is append-only memory made of fixed size blocks.
+ * Bytes are addressed by a 32-bit offset into the pool (block index and
+ * offset within the block). reset() makes every block reusable in O(1);
+ * a block is zeroed again only when it is reused.
+ *
+ * It also hands out slices: byte streams that start small and grow by
+ * chaining bigger slices (5, 14, 20, ... 200 bytes) as they fill up, so that
+ * the many short postings lists cost a few bytes each while long ones still
+ * append in O(1). The last byte of a slice is a non-zero marker holding its
+ * level; when a writer reaches it, the slice's last 4 bytes are replaced by
+ * the address of the next slice.
+ */
+class ByteBlockPool {
+public:
+  static constexpr uint32_t BlockShift = 15;
+  static constexpr uint32_t BlockSize = 1u << BlockShift;
+  static constexpr uint32_t BlockMask = BlockSize - 1;
+
+private:
+  std::vector<std::unique_ptr<uint8_t[]>> blocks;
+  std::size_t used_blocks; // blocks in use, the last one is being filled
+  uint32_t byte_upto;      // next free byte in the last block in use
+  void next_block();
+
+public:
+  ByteBlockPool();
+  ~ByteBlockPool();
+  ByteBlockPool(ByteBlockPool &&) = default;
+  ByteBlockPool &operator=(ByteBlockPool &&) = default;
+  void reset();
+  // size contiguous zeroed bytes, size <= BlockSize
+  uint32_t allocate(uint32_t size);
+  uint8_t *at(uint32_t address) {
+    return blocks[address >> BlockShift].get() + (address & BlockMask);
+  }
+  const uint8_t *at(uint32_t address) const {
+    return blocks[address >> BlockShift].get() + (address & BlockMask);
+  }
+  // start a new slice, returns where to write its first byte
+  uint32_t new_slice();
+  // append to the slice whose write position is upto, growing it if full
+  void write_byte(uint32_t &upto, uint8_t byte);
+  void write_vint(uint32_t &upto, uint64_t value);
+  std::size_t bytes_used() const;
+
+  static const uint8_t LevelSize[];
+  static const uint8_t NextLevel[];
+
+private:
+  uint32_t grow_slice(uint32_t marker);
+};
+
+/*
+ * Reads back a slice stream written with ByteBlockPool::write_byte, from its
+ * start address to the writer's current position.
+ */
+class ByteSliceReader {
+  const ByteBlockPool *pool;
+  const uint8_t *buffer; // block holding the current slice
+  uint32_t buffer_offset; // pool address of buffer
+  uint32_t upto;          // read position in buffer
+  uint32_t limit;         // end of data in the current slice
+  uint32_t end;           // pool address where the stream ends
+  int level;
+  void next_slice();
+
+public:
+  ByteSliceReader(const ByteBlockPool *pool, uint32_t start, uint32_t end);
+  bool eof() const { return buffer_offset + upto == end; }
+  uint8_t read_byte() {
+    if (upto == limit) {
+      next_slice();
+    }
+    return buffer[upto++];
+  }
+  uint64_t read_vint();
+};
+
+/*
+ * TermsHash interns terms: it maps each distinct term to a dense id
+ * (0, 1, 2, ... in order of first occurrence) with an open addressing
+ * table of ids, and keeps the term bytes in a ByteBlockPool. Adding a term
+ * that is already known allocates nothing.
+ */
+class TermsHash {
+  ByteBlockPool pool;            // 2 byte length followed by the term
+  std::vector<uint32_t> starts;  // pool address of each term
+  std::vector<uint32_t> hashes;  // hash of each term
+  std::vector<int32_t> table;    // term id or -1
+  void rehash(std::size_t size);
+
+public:
+  // a term must fit in one block together with its length
+  static constexpr std::size_t MaxTermLength = ByteBlockPool::BlockSize - 2;
+  TermsHash();
+  ~TermsHash();
+  TermsHash(TermsHash &&) = default;
+  TermsHash &operator=(TermsHash &&) = default;
+  // id of term, interning it first if needed; -1 for terms longer than
+  // MaxTermLength, which are not indexed
+  int32_t add(std::string_view term, bool &is_new);
+  int32_t find(std::string_view term) const;
+  std::string_view get(uint32_t id) const;
+  std::size_t size() const { return starts.size(); }
+  std::size_t bytes_used() const;
+  void reset();
+};
@@ -0,0 +1,725 @@
+#include "query.h"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+
+DocIterator::~DocIterator() = default;
+
+/*
+ * TermIterator constructor
+ */
+TermIterator::TermIterator(PostingsIterator postings)
+    : postings(std::move(postings)) {}
+docid_t TermIterator::next_doc() { return postings.next_doc(); }
+docid_t TermIterator::advance(docid_t target) {
+  return postings.advance(target);
+}
+docid_t TermIterator::docid() const { return postings.docid(); }
+uint64_t TermIterator::cost() const { return postings.get_doc_freq(); }
+const std::vector<term_id_t> &TermIterator::positions() {
+  return postings.get_positions();
+}
+
+/*
+ * ConjunctionIterator constructor
+ */
+ConjunctionIterator::ConjunctionIterator(
+    std::vector<std::unique_ptr<DocIterator>> iterators)
+    : iterators(std::move(iterators)), current(NoMoreDocs) {
+  std::sort(this->iterators.begin(), this->iterators.end(),
+            [](const auto &a, const auto &b) { return a->cost() < b->cost(); });
+}
+
+/*
+ * From the lead's doc, advance the others until they all agree.
+ */
+docid_t ConjunctionIterator::align(docid_t doc) {
+  for (;;) {
+    if (doc == NoMoreDocs) {
+      current = NoMoreDocs;
+      return current;
+    }
+    bool agreed = true;
+    for (std::size_t i = 1; i < iterators.size(); ++i) {
+      docid_t other = iterators[i]->advance(doc);
+      if (other > doc) {
+        doc = iterators[0]->advance(other);
+        agreed = false;
+        break;
+      }
+    }
+    if (agreed) {
+      current = doc;
+      return current;
+    }
+  }
+}
+docid_t ConjunctionIterator::next_doc() {
+  return align(iterators[0]->next_doc());
+}
+docid_t ConjunctionIterator::advance(docid_t target) {
+  return align(iterators[0]->advance(target));
+}
+docid_t ConjunctionIterator::docid() const { return current; }
+uint64_t ConjunctionIterator::cost() const { return iterators[0]->cost(); }
+
+// heap order: the iterator on the smallest docid on top
+static bool after(const DocIterator *a, const DocIterator *b) {
+  return a->docid() > b->docid();
+}
+
+/*
+ * DisjunctionIterator constructor
+ */
+DisjunctionIterator::DisjunctionIterator(
+    std::vector<std::unique_ptr<DocIterator>> iterators)
+    : iterators(std::move(iterators)), current(NoMoreDocs), started(false) {}
+
+void DisjunctionIterator::start(docid_t target) {
+  for (auto &iterator : iterators) {
+    iterator->advance(target);
+    heap.push_back(iterator.get());
+  }
+  std::make_heap(heap.begin(), heap.end(), after);
+  started = true;
+}
+void DisjunctionIterator::update_top() {
+  std::pop_heap(heap.begin(), heap.end(), after);
+  std::push_heap(heap.begin(), heap.end(), after);
+}
+docid_t DisjunctionIterator::next_doc() {
+  if (!started) {
+    start(0);
+  } else if (current != NoMoreDocs) {
+    while (heap[0]->docid() == current) {
+      heap[0]->next_doc();
+      update_top();
+    }
+  }
+  current = heap[0]->docid();
+  return current;
+}
+docid_t DisjunctionIterator::advance(docid_t target) {
+  if (!started) {
+    start(target);
+  } else {
+    while (heap[0]->docid() < target) {
+      heap[0]->advance(target);
+      update_top();
+    }
+  }
+  current = heap[0]->docid();
+  return current;
+}
+docid_t DisjunctionIterator::docid() const { return current; }
+uint64_t DisjunctionIterator::cost() const {
+  uint64_t total = 0;
+  for (const auto &iterator : iterators) {
+    total += iterator->cost();
+  }
+  return total;
+}
+
+/*
+ * ExclusionIterator constructor
+ */
+ExclusionIterator::ExclusionIterator(std::unique_ptr<DocIterator> include,
+                                     std::unique_ptr<DocIterator> exclude)
+    : include(std::move(include)), exclude(std::move(exclude)) {}
+
+docid_t ExclusionIterator::skip_excluded(docid_t doc) {
+  while (doc != NoMoreDocs && exclude->advance(doc) == doc) {
+    doc = include->next_doc();
+  }
+  return doc;
+}
+docid_t ExclusionIterator::next_doc() {
+  return skip_excluded(include->next_doc());
+}
+docid_t ExclusionIterator::advance(docid_t target) {
+  return skip_excluded(include->advance(target));
+}
+docid_t ExclusionIterator::docid() const { return include->docid(); }
+uint64_t ExclusionIterator::cost() const { return include->cost(); }
+
+/*
+ * PhraseIterator constructor
+ */
+PhraseIterator::PhraseIterator(std::vector<std::unique_ptr<TermIterator>> terms,
+                               const std::vector<std::string> &texts,
+                               uint32_t slop)
+    : slop(slop), same_as(terms.size()), required(terms.size(), 0),
+      distinct_terms(0), upto(terms.size()), counts(terms.size()) {
+  std::vector<std::unique_ptr<DocIterator>> iterators;
+  for (std::size_t i = 0; i < terms.size(); ++i) {
+    same_as[i] = std::find(texts.begin(), texts.begin() + i, texts[i]) -
+                 texts.begin();
+    distinct_terms += same_as[i] == i;
+    required[same_as[i]]++;
+    this->terms.push_back(terms[i].get());
+    iterators.push_back(std::move(terms[i]));
+  }
+  approximation = std::make_unique<ConjunctionIterator>(std::move(iterators));
+}
+
+/*
+ * The phrase starts at position - i of every term i: each term in turn
+ * moves to the first position where it could sit, and moves the start
+ * when it lands further, until all of them agree.
+ */
+bool PhraseIterator::exact_match() {
+  std::fill(upto.begin(), upto.end(), 0);
+  term_id_t start = 0;
+  std::size_t agreed = 0;
+  for (std::size_t i = 0; agreed < terms.size(); i = (i + 1) % terms.size()) {
+    const std::vector<term_id_t> &positions = terms[i]->positions();
+    std::size_t &at = upto[i];
+    while (at < positions.size() && positions[at] < start + i) {
+      at++;
+    }
+    if (at == positions.size()) {
+      return false;
+    }
+    if (positions[at] == start + i) {
+      agreed++;
+    } else {
+      start = positions[at] - i;
+      agreed = 1;
+    }
+  }
+  return true;
+}
+
+/*
+ * Merges the positions of the distinct terms and slides a window over
+ * them: at each position, the shortest window ending there that holds
+ * every term as many times as the phrase does. The merge stops at the
+ * first window narrow enough.
+ */
+bool PhraseIterator::sloppy_match() {
+  term_id_t width = (term_id_t)(terms.size() - 1 + slop);
+  merged.clear();
+  std::fill(upto.begin(), upto.end(), 0);
+  std::fill(counts.begin(), counts.end(), 0);
+  std::size_t satisfied = 0;
+  std::size_t left = 0;
+  for (;;) {
+    std::size_t lowest = terms.size();
+    term_id_t position = 0;
+    for (std::size_t i = 0; i < terms.size(); ++i) {
+      if (same_as[i] != i) {
+        continue;
+      }
+      const std::vector<term_id_t> &positions = terms[i]->positions();
+      if (upto[i] < positions.size() &&
+          (lowest == terms.size() || positions[upto[i]] < position)) {
+        lowest = i;
+        position = positions[upto[i]];
+      }
+    }
+    if (lowest == terms.size()) {
+      return false;
+    }
+    merged.emplace_back(position, lowest);
+    upto[lowest]++;
+    if (++counts[lowest] == required[lowest]) {
+      satisfied++;
+    }
+    while (satisfied == distinct_terms) {
+      if (position - merged[left].first <= width) {
+        return true;
+      }
+      std::size_t dropped = merged[left++].second;
+      if (counts[dropped]-- == required[dropped]) {
+        satisfied--;
+      }
+    }
+  }
+}
+
+docid_t PhraseIterator::verify(docid_t doc) {
+  while (doc != NoMoreDocs && !(slop == 0 ? exact_match() : sloppy_match())) {
+    doc = approximation->next_doc();
+  }
+  return doc;
+}
+docid_t PhraseIterator::next_doc() {
+  return verify(approximation->next_doc());
+}
+docid_t PhraseIterator::advance(docid_t target) {
+  docid_t doc = approximation->docid();
+  if (doc != NoMoreDocs && doc >= target) {
+    return doc;
+  }
+  return verify(approximation->advance(target));
+}
+docid_t PhraseIterator::docid() const { return approximation->docid(); }
+uint64_t PhraseIterator::cost() const { return approximation->cost(); }
+
+Query::~Query() = default;
+
+/*
+ * TermQuery constructor
+ */
+TermQuery::TermQuery(const std::string &field, const std::string &term)
+    : field(field), term(term) {}
+
+std::unique_ptr<DocIterator>
+TermQuery::iterator(const SegmentReader &segment) const {
+  const FieldReader *field_reader = segment.get_field(field);
+  TermInfo info;
+  if (!field_reader || !field_reader->get_terms().seek_exact(term, info)) {
+    return nullptr;
+  }
+  return std::make_unique<TermIterator>(field_reader->postings(info));
+}
+std::string TermQuery::to_string() const { return field + ":" + term; }
+void TermQuery::create_weights(
+    const IndexReader &reader,
+    std::vector<std::unique_ptr<Weight>> &weights) const {
+  weights.push_back(std::make_unique<TermWeight>(reader, field, term));
+}
+bool TermQuery::is_term_disjunction() const { return true; }
+
+// one iterator as is, several as their disjunction
+static std::unique_ptr<DocIterator>
+any_of(std::vector<std::unique_ptr<DocIterator>> iterators) {
+  if (iterators.size() == 1) {
+    return std::move(iterators[0]);
+  }
+  return std::make_unique<DisjunctionIterator>(std::move(iterators));
+}
+
+/*
+ * CombinedFieldQuery constructor
+ */
+CombinedFieldQuery::CombinedFieldQuery(const std::vector<FieldBoost> &fields,
+                                       const std::string &term)
+    : fields(fields), term(term) {
+  if (fields.empty()) {
+    throw std::runtime_error("No field to search " + term + " in");
+  }
+}
+
+std::unique_ptr<DocIterator>
+CombinedFieldQuery::iterator(const SegmentReader &segment) const {
+  std::vector<std::unique_ptr<DocIterator>> iterators;
+  TermInfo info;
+  for (const auto &field : fields) {
+    const FieldReader *field_reader = segment.get_field(field.field);
+    if (field_reader && field_reader->get_terms().seek_exact(term, info)) {
+      iterators.push_back(
+          std::make_unique<TermIterator>(field_reader->postings(info)));
+    }
+  }
+  if (iterators.empty()) {
+    return nullptr;
+  }
+  return any_of(std::move(iterators));
+}
+std::string CombinedFieldQuery::to_string() const {
+  std::ostringstream text;
+  text << "{";
+  for (std::size_t i = 0; i < fields.size(); ++i) {
+    text << (i ? " " : "") << fields[i].field;
+    if (fields[i].boost != 1) {
+      text << "^" << fields[i].boost;
+    }
+  }
+  text << "}:" << term;
+  return text.str();
+}
+void CombinedFieldQuery::create_weights(
+    const IndexReader &reader,
+    std::vector<std::unique_ptr<Weight>> &weights) const {
+  weights.push_back(std::make_unique<CombinedFieldWeight>(reader, fields, term));
+}
+bool CombinedFieldQuery::is_term_disjunction() const { return true; }
+
+/*
+ * PhraseQuery constructor
+ */
+PhraseQuery::PhraseQuery(const std::string &field,
+                         const std::vector<std::string> &terms, uint32_t slop)
+    : slop(slop) {
+  if (terms.empty()) {
+    throw std::runtime_error("Empty phrase in field " + field);
+  }
+  for (const auto &term : terms) {
+    this->terms.emplace_back(field, term);
+  }
+}
+
+std::unique_ptr<DocIterator>
+PhraseQuery::iterator(const SegmentReader &segment) const {
+  const FieldReader *field_reader = segment.get_field(terms[0].get_field());
+  if (!field_reader) {
+    return nullptr;
+  }
+  std::vector<std::unique_ptr<TermIterator>> iterators;
+  std::vector<std::string> texts;
+  TermInfo info;
+  for (const auto &term : terms) {
+    if (!field_reader->get_terms().seek_exact(term.get_term(), info)) {
+      return nullptr;
+    }
+    iterators.push_back(
+        std::make_unique<TermIterator>(field_reader->postings(info)));
+    texts.push_back(term.get_term());
+  }
+  if (iterators.size() == 1) {
+    return std::move(iterators[0]);
+  }
+  return std::make_unique<PhraseIterator>(std::move(iterators), texts, slop);
+}
+std::string PhraseQuery::to_string() const {
+  std::string text = terms[0].get_field() + ":\"";
+  for (std::size_t i = 0; i < terms.size(); ++i) {
+    text += (i ? " " : "") + terms[i].get_term();
+  }
+  text += "\"";
+  return slop ? text + "~" + std::to_string(slop) : text;
+}
+void PhraseQuery::create_weights(
+    const IndexReader &reader,
+    std::vector<std::unique_ptr<Weight>> &weights) const {
+  for (const auto &term : terms) {
+    term.create_weights(reader, weights);
+  }
+}
+bool PhraseQuery::is_term_disjunction() const { return false; }
+
+/*
+ * BooleanQuery constructor
+ */
+BooleanQuery::BooleanQuery() = default;
+
+void BooleanQuery::add(Occur occur, std::unique_ptr<Query> query) {
+  clauses.emplace_back(occur, std::move(query));
+}
+
+std::unique_ptr<DocIterator>
+BooleanQuery::iterator(const SegmentReader &segment) const {
+  std::vector<std::unique_ptr<DocIterator>> must;
+  std::vector<std::unique_ptr<DocIterator>> should;
+  std::vector<std::unique_ptr<DocIterator>> must_not;
+  bool positive = false;
+  for (const auto &[occur, query] : clauses) {
+    auto iterator = query->iterator(segment);
+    positive |= occur != Occur::MUST_NOT;
+    if (occur == Occur::MUST && !iterator) {
+      return nullptr;
+    }
+    if (iterator) {
+      (occur == Occur::MUST     ? must
+       : occur == Occur::SHOULD ? should
+                                : must_not)
+          .push_back(std::move(iterator));
+    }
+  }
+  if (!positive) {
+    throw std::runtime_error("Query " + to_string() +
+                             " has no positive clause");
+  }
+  std::unique_ptr<DocIterator> matches;
+  if (!must.empty()) {
+    // SHOULD clauses are optional next to MUST ones
+    matches = must.size() == 1
+                  ? std::move(must[0])
+                  : std::make_unique<ConjunctionIterator>(std::move(must));
+  } else if (!should.empty()) {
+    matches = any_of(std::move(should));
+  } else {
+    return nullptr;
+  }
+  if (!must_not.empty()) {
+    matches = std::make_unique<ExclusionIterator>(std::move(matches),
+                                                  any_of(std::move(must_not)));
+  }
+  return matches;
+}
+std::string BooleanQuery::to_string() const {
+  std::string text = "(";
+  for (const auto &[occur, query] : clauses) {
+    if (text.size() > 1) {
+      text += " ";
+    }
+    text += occur == Occur::MUST       ? "+"
+            : occur == Occur::MUST_NOT ? "-"
+                                       : "";
+    text += query->to_string();
+  }
+  return text + ")";
+}
+void BooleanQuery::create_weights(
+    const IndexReader &reader,
+    std::vector<std::unique_ptr<Weight>> &weights) const {
+  for (const auto &[occur, query] : clauses) {
+    if (occur != Occur::MUST_NOT) {
+      query->create_weights(reader, weights);
+    }
+  }
+}
+bool BooleanQuery::is_term_disjunction() const {
+  return std::all_of(clauses.begin(), clauses.end(), [](const auto &clause) {
+    return clause.first == Occur::SHOULD && clause.second->is_term_disjunction();
+  });
+}
+
+/*
+ * Recursive descent parser of the query syntax, see Query::parse.
+ */
+class QueryParser {
+  std::vector<std::string> tokens;
+  std::size_t next;
+  const std::vector<FieldBoost> &default_fields;
+
+  bool at(const char *token) const {
+    return next < tokens.size() && tokens[next] == token;
+  }
+  std::unique_ptr<Query> parse_or() {
+    std::vector<std::unique_ptr<Query>> alternatives;
+    alternatives.push_back(parse_and());
+    while (at("OR")) {
+      next++;
+      alternatives.push_back(parse_and());
+    }
+    if (alternatives.size() == 1) {
+      return std::move(alternatives[0]);
+    }
+    auto query = std::make_unique<BooleanQuery>();
+    for (auto &alternative : alternatives) {
+      query->add(BooleanQuery::Occur::SHOULD, std::move(alternative));
+    }
+    return query;
+  }
+  std::unique_ptr<Query> parse_and() {
+    std::vector<std::pair<bool, std::unique_ptr<Query>>> clauses;
+    while (next < tokens.size() && !at("OR") && !at(")")) {
+      bool negated = false;
+      for (; at("-"); next++) {
+        negated = !negated;
+      }
+      clauses.emplace_back(negated, parse_primary());
+    }
+    if (clauses.empty()) {
+      throw std::runtime_error("Empty query clause");
+    }
+    if (clauses.size() == 1 && !clauses[0].first) {
+      return std::move(clauses[0].second);
+    }
+    auto query = std::make_unique<BooleanQuery>();
+    bool positive = false;
+    for (auto &[negated, clause] : clauses) {
+      positive |= !negated;
+      query->add(negated ? BooleanQuery::Occur::MUST_NOT
+                         : BooleanQuery::Occur::MUST,
+                 std::move(clause));
+    }
+    if (!positive) {
+      throw std::runtime_error("Query " + query->to_string() +
+                               " has no positive clause");
+    }
+    return query;
+  }
+  std::unique_ptr<Query> parse_primary() {
+    if (next == tokens.size()) {
+      throw std::runtime_error("Query ends after -");
+    }
+    if (at("(")) {
+      next++;
+      auto query = parse_or();
+      if (!at(")")) {
+        throw std::runtime_error("Unbalanced parentheses in query");
+      }
+      next++;
+      return query;
+    }
+    if (at(")")) {
+      throw std::runtime_error("Unbalanced parentheses in query");
+    }
+    const std::string &token = tokens[next++];
+    std::size_t colon = token.find(':');
+    std::size_t quote = token.find('"');
+    std::vector<FieldBoost> fields = default_fields;
+    std::string text = token;
+    if (colon != std::string::npos && colon > 0 && colon + 1 < token.size() &&
+        colon < quote) {
+      fields = {FieldBoost{token.substr(0, colon)}};
+      text = token.substr(colon + 1);
+    }
+    if (text[0] == '"') {
+      return parse_phrase(fields, text);
+    }
+    if (quote != std::string::npos) {
+      throw std::runtime_error("Misplaced quote in query term " + token);
+    }
+    return term_query(fields, text);
+  }
+  std::unique_ptr<Query> term_query(const std::vector<FieldBoost> &fields,
+                                    const std::string &term) {
+    if (fields.size() == 1) {
+      return std::make_unique<TermQuery>(fields[0].field, term);
+    }
+    return std::make_unique<CombinedFieldQuery>(fields, term);
+  }
+  // "a b c" or "a b c"~slop
+  std::unique_ptr<Query> parse_phrase(const std::vector<FieldBoost> &fields,
+                                      const std::string &text) {
+    std::size_t close = text.find('"', 1);
+    std::vector<std::string> words;
+    for (std::size_t i = 1; i < close;) {
+      if (std::isspace((unsigned char)text[i])) {
+        i++;
+        continue;
+      }
+      std::size_t start = i;
+      while (i < close && !std::isspace((unsigned char)text[i])) {
+        i++;
+      }
+      words.push_back(text.substr(start, i - start));
+    }
+    std::string suffix = text.substr(close + 1);
+    uint32_t slop = 0;
+    if (!suffix.empty()) {
+      if (suffix.size() < 2 || suffix[0] != '~' ||
+          suffix.find_first_not_of("0123456789", 1) != std::string::npos) {
+        throw std::runtime_error("Bad phrase suffix in query: " + suffix);
+      }
+      slop = (uint32_t)std::stoul(suffix.substr(1));
+    }
+    if (words.empty()) {
+      throw std::runtime_error("Empty phrase in query");
+    }
+    if (words.size() == 1) {
+      return term_query(fields, words[0]);
+    }
+    if (fields.size() == 1) {
+      return std::make_unique<PhraseQuery>(fields[0].field, words, slop);
+    }
+    auto query = std::make_unique<BooleanQuery>();
+    for (const auto &field : fields) {
+      query->add(BooleanQuery::Occur::SHOULD,
+                 std::make_unique<PhraseQuery>(field.field, words, slop));
+    }
+    return query;
+  }
+
+public:
+  QueryParser(const std::string &query,
+              const std::vector<FieldBoost> &default_fields)
+      : next(0), default_fields(default_fields) {
+    if (default_fields.empty()) {
+      throw std::runtime_error("No default field to search");
+    }
+    // words, parentheses, and - at the start of a word; a quoted phrase is
+    // part of its word, spaces included
+    std::size_t i = 0;
+    while (i < query.size()) {
+      char c = query[i];
+      if (std::isspace((unsigned char)c)) {
+        i++;
+      } else if (c == '(' || c == ')' || c == '-') {
+        tokens.emplace_back(1, c);
+        i++;
+      } else {
+        std::size_t start = i;
+        while (i < query.size() && !std::isspace((unsigned char)query[i]) &&
+               query[i] != '(' && query[i] != ')') {
+          if (query[i] == '"') {
+            i = query.find('"', i + 1);
+            if (i == std::string::npos) {
+              throw std::runtime_error("Unbalanced quotes in query");
+            }
+          }
+          i++;
+        }
+        tokens.push_back(query.substr(start, i - start));
+      }
+    }
+  }
+  std::unique_ptr<Query> parse() {
+    auto query = parse_or();
+    if (next != tokens.size()) {
+      throw std::runtime_error("Unbalanced parentheses in query");
+    }
+    return query;
+  }
+};
+
+std::unique_ptr<Query> Query::parse(const std::string &query,
+                                    const std::vector<FieldBoost> &default_fields) {
+  return QueryParser(query, default_fields).parse();
+}
+std::unique_ptr<Query> Query::parse(const std::string &query,
+                                    const std::string &default_field) {
+  return parse(query, std::vector<FieldBoost>{FieldBoost{default_field}});
+}
+
+/*
+ * IndexSearcher constructor
+ */
+IndexSearcher::IndexSearcher(const IndexReader *reader) : reader(reader) {}
+
+/*
+ * Segments hold disjoint sets of docids, so the matches of every segment
+ * are concatenated and sorted once.
+ */
+std::vector<docid_t> IndexSearcher::search(const Query &query) const {
+  std::vector<docid_t> docids;
+  for (const auto &segment : reader->get_segments()) {
+    auto iterator = query.iterator(*segment);
+    if (!iterator) {
+      continue;
+    }
+    for (docid_t doc = iterator->next_doc(); doc != DocIterator::NoMoreDocs;
+         doc = iterator->next_doc()) {
+      docids.push_back(doc);
+    }
+  }
+  std::sort(docids.begin(), docids.end());
+  return docids;
+}
+
+/*
+ * The collector, and so the threshold WAND prunes with, carries over from
+ * one segment to the next.
+ */
+std::vector<ScoreDoc> IndexSearcher::search(const Query &query, std::size_t k,
+                                            ScoreMode mode) const {
+  std::vector<std::unique_ptr<Weight>> weights;
+  query.create_weights(*reader, weights);
+  bool wand = mode != ScoreMode::Exhaustive && query.is_term_disjunction();
+  TopKCollector collector(k);
+  for (const auto &segment : reader->get_segments()) {
+    std::vector<std::unique_ptr<Scorer>> owned;
+    std::vector<Scorer *> scorers;
+    for (std::size_t i = 0; i < weights.size(); ++i) {
+      if (auto scorer = weights[i]->scorer(*segment, i)) {
+        scorers.push_back(scorer.get());
+        owned.push_back(std::move(scorer));
+      }
+    }
+    if (wand) {
+      score_wand(scorers, mode == ScoreMode::BlockMaxWAND, collector);
+    } else if (auto matches = query.iterator(*segment)) {
+      score_exhaustive(*matches, scorers, collector);
+    }
+  }
+  return collector.top();
+}
+
+uint64_t IndexSearcher::count(const Query &query) const {
+  uint64_t total = 0;
+  for (const auto &segment : reader->get_segments()) {
+    auto iterator = query.iterator(*segment);
+    if (!iterator) {
+      continue;
+    }
+    while (iterator->next_doc() != DocIterator::NoMoreDocs) {
+      total++;
+    }
+  }
+  return total;
+}
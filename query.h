@@ -0,0 +1,282 @@
+// query parsing and document-at-a-time evaluation
+#pragma once
+
+#include "codec.h"
+#include "reader.h"
+#include "scorer.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * DocIterator walks the docs matching (part of) a query in one segment, in
+ * increasing docid order. Before the first next_doc() or advance() it is
+ * not on any doc.
+ */
+class DocIterator {
+public:
+  static constexpr docid_t NoMoreDocs = PostingsIterator::NoMoreDocs;
+
+  virtual ~DocIterator();
+  // moves to the next doc and returns it, NoMoreDocs after the last one
+  virtual docid_t next_doc() = 0;
+  // moves to the first doc >= target and returns it; stays on the current
+  // doc if it is already there
+  virtual docid_t advance(docid_t target) = 0;
+  virtual docid_t docid() const = 0;
+  // upper bound of the docs it matches, to order clauses
+  virtual uint64_t cost() const = 0;
+};
+
+/*
+ * Docs of one term.
+ */
+class TermIterator : public DocIterator {
+  PostingsIterator postings;
+
+public:
+  TermIterator(PostingsIterator postings);
+  docid_t next_doc() override;
+  docid_t advance(docid_t target) override;
+  docid_t docid() const override;
+  uint64_t cost() const override;
+  // of the term in the current doc, decoded on the first call
+  const std::vector<term_id_t> &positions();
+};
+
+/*
+ * Docs matching every sub-iterator. They are ordered by cost so that the
+ * rarest one leads: it proposes a doc and the others advance() to it. When
+ * one overshoots, the lead advances to where it landed, so the common
+ * lists are only probed at the candidates of the rare one.
+ */
+class ConjunctionIterator : public DocIterator {
+  std::vector<std::unique_ptr<DocIterator>> iterators; // by cost
+  docid_t current;
+  docid_t align(docid_t target);
+
+public:
+  ConjunctionIterator(std::vector<std::unique_ptr<DocIterator>> iterators);
+  docid_t next_doc() override;
+  docid_t advance(docid_t target) override;
+  docid_t docid() const override;
+  uint64_t cost() const override;
+};
+
+/*
+ * Docs matching any sub-iterator, merged through a min-heap on their
+ * current docs.
+ */
+class DisjunctionIterator : public DocIterator {
+  std::vector<std::unique_ptr<DocIterator>> iterators;
+  std::vector<DocIterator *> heap; // smallest docid on top
+  docid_t current;
+  bool started;
+  void start(docid_t target);
+  // re-sifts the top after it moved
+  void update_top();
+
+public:
+  DisjunctionIterator(std::vector<std::unique_ptr<DocIterator>> iterators);
+  docid_t next_doc() override;
+  docid_t advance(docid_t target) override;
+  docid_t docid() const override;
+  uint64_t cost() const override;
+};
+
+/*
+ * Docs where the terms of a phrase occur at matching positions. The docs
+ * with every term come from a conjunction, and the positions of the terms
+ * are only decoded for those, then merged: with slop 0 the terms must
+ * follow each other in order, otherwise they must all fall, in any order,
+ * within a window of slop words more than the phrase.
+ */
+class PhraseIterator : public DocIterator {
+  std::unique_ptr<DocIterator> approximation;
+  std::vector<TermIterator *> terms; // in phrase order, owned by approximation
+  uint32_t slop;
+  // per term, the first one with the same text and how many share it
+  std::vector<std::size_t> same_as;
+  std::vector<uint32_t> required;
+  std::size_t distinct_terms;
+  // scratch of the merges
+  std::vector<std::size_t> upto;
+  std::vector<uint32_t> counts;
+  std::vector<std::pair<term_id_t, std::size_t>> merged;
+  bool exact_match();
+  bool sloppy_match();
+  docid_t verify(docid_t doc);
+
+public:
+  // texts are the terms' texts, to spot repeated ones
+  PhraseIterator(std::vector<std::unique_ptr<TermIterator>> terms,
+                 const std::vector<std::string> &texts, uint32_t slop);
+  docid_t next_doc() override;
+  docid_t advance(docid_t target) override;
+  docid_t docid() const override;
+  uint64_t cost() const override;
+};
+
+/*
+ * Docs of include that exclude does not match. exclude only ever advances
+ * to the candidates of include.
+ */
+class ExclusionIterator : public DocIterator {
+  std::unique_ptr<DocIterator> include;
+  std::unique_ptr<DocIterator> exclude;
+  docid_t skip_excluded(docid_t doc);
+
+public:
+  ExclusionIterator(std::unique_ptr<DocIterator> include,
+                    std::unique_ptr<DocIterator> exclude);
+  docid_t next_doc() override;
+  docid_t advance(docid_t target) override;
+  docid_t docid() const override;
+  uint64_t cost() const override;
+};
+
+class TermQuery;
+
+/*
+ * Query is a tree of term queries combined by boolean queries. It is
+ * evaluated one segment at a time. The terms, or for CombinedFieldQuery
+ * the terms over several fields, are the leaves whose scores add up to
+ * the score of a doc.
+ */
+class Query {
+public:
+  virtual ~Query();
+  // the docs of segment matching the query, nullptr if none can
+  virtual std::unique_ptr<DocIterator>
+  iterator(const SegmentReader &segment) const = 0;
+  virtual std::string to_string() const = 0;
+  // the Weights of the leaves scoring the docs it matches: all but the
+  // MUST_NOT ones
+  virtual void
+  create_weights(const IndexReader &reader,
+                 std::vector<std::unique_ptr<Weight>> &weights) const = 0;
+  // a leaf or an OR of leaves, which WAND can evaluate
+  virtual bool is_term_disjunction() const = 0;
+
+  /*
+   * Parses a query string:
+   *   a b          docs with both a and b
+   *   a OR b       docs with either; AND binds tighter than OR
+   *   -a           docs without a, only next to a positive clause
+   *   (a OR b) c   grouping
+   *   title:a      a in field title instead of the default fields
+   *   "a b"        a followed by b, title:"a b" in field title
+   *   "a b"~2      a and b within 2 words more than the phrase, any order
+   * Terms are matched as written, like the indexer stores them. Over
+   * several default fields a term is a CombinedFieldQuery, and a phrase
+   * matches in any of them.
+   */
+  static std::unique_ptr<Query>
+  parse(const std::string &query, const std::vector<FieldBoost> &default_fields);
+  static std::unique_ptr<Query> parse(const std::string &query,
+                                      const std::string &default_field);
+};
+
+class TermQuery : public Query {
+  std::string field;
+  std::string term;
+
+public:
+  TermQuery(const std::string &field, const std::string &term);
+  const std::string &get_field() const { return field; }
+  const std::string &get_term() const { return term; }
+  std::unique_ptr<DocIterator>
+  iterator(const SegmentReader &segment) const override;
+  std::string to_string() const override;
+  void create_weights(
+      const IndexReader &reader,
+      std::vector<std::unique_ptr<Weight>> &weights) const override;
+  bool is_term_disjunction() const override;
+};
+
+/*
+ * Matches docs with the term in any of the fields, scored as one term
+ * with BM25F (see scorer.h) so that the boosted fields, title or anchor
+ * text, weigh in proportion without adding up as separate terms.
+ */
+class CombinedFieldQuery : public Query {
+  std::vector<FieldBoost> fields;
+  std::string term;
+
+public:
+  CombinedFieldQuery(const std::vector<FieldBoost> &fields,
+                     const std::string &term);
+  std::unique_ptr<DocIterator>
+  iterator(const SegmentReader &segment) const override;
+  std::string to_string() const override;
+  void create_weights(
+      const IndexReader &reader,
+      std::vector<std::unique_ptr<Weight>> &weights) const override;
+  bool is_term_disjunction() const override;
+};
+
+/*
+ * Matches docs where the terms of field occur as a phrase, see
+ * PhraseIterator for slop. Matches are scored by their terms.
+ */
+class PhraseQuery : public Query {
+  std::vector<TermQuery> terms;
+  uint32_t slop;
+
+public:
+  PhraseQuery(const std::string &field, const std::vector<std::string> &terms,
+              uint32_t slop = 0);
+  std::unique_ptr<DocIterator>
+  iterator(const SegmentReader &segment) const override;
+  std::string to_string() const override;
+  void create_weights(
+      const IndexReader &reader,
+      std::vector<std::unique_ptr<Weight>> &weights) const override;
+  bool is_term_disjunction() const override;
+};
+
+/*
+ * Matches docs matching every MUST clause and, if there are none, at least
+ * one SHOULD clause, and no MUST_NOT clause.
+ */
+class BooleanQuery : public Query {
+public:
+  enum class Occur { MUST, SHOULD, MUST_NOT };
+
+private:
+  std::vector<std::pair<Occur, std::unique_ptr<Query>>> clauses;
+
+public:
+  BooleanQuery();
+  void add(Occur occur, std::unique_ptr<Query> query);
+  std::unique_ptr<DocIterator>
+  iterator(const SegmentReader &segment) const override;
+  std::string to_string() const override;
+  void create_weights(
+      const IndexReader &reader,
+      std::vector<std::unique_ptr<Weight>> &weights) const override;
+  bool is_term_disjunction() const override;
+};
+
+/*
+ * IndexSearcher runs queries over every segment of an IndexReader. Ranked
+ * searches score docs with BM25 over the statistics of the whole index,
+ * the sum of the scores of the query's leaves in the doc.
+ */
+class IndexSearcher {
+  const IndexReader *reader; // not owned
+
+public:
+  IndexSearcher(const IndexReader *reader);
+  // matching docids, in increasing order
+  std::vector<docid_t> search(const Query &query) const;
+  uint64_t count(const Query &query) const;
+  /*
+   * The k best docs by score, then by docid. Term disjunctions are pruned
+   * with (Block-Max) WAND unless mode is Exhaustive; other queries score
+   * every match. The modes return the same docs.
+   */
+  std::vector<ScoreDoc> search(const Query &query, std::size_t k,
+                               ScoreMode mode = ScoreMode::BlockMaxWAND) const;
+};
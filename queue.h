@@ -0,0 +1,183 @@
+// bounded lock-free queue and stage statistics for the ingest pipeline
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+/*
+ * Counters of one pipeline stage, shared by all threads of the stage.
+ * Time is split into working, waiting for input (starved) and waiting for
+ * room in the next queue (backpressure).
+ */
+struct StageStats {
+  std::atomic<uint64_t> items{0};
+  std::atomic<uint64_t> busy_ns{0};
+  std::atomic<uint64_t> starved_ns{0};
+  std::atomic<uint64_t> blocked_ns{0};
+
+  static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+};
+
+/*
+ * Bounded multi-producer multi-consumer queue without locks (a ring of
+ * cells with per-cell sequence numbers, after Dmitry Vyukov's design).
+ * push() blocks while the queue is full, which is how a slow stage holds
+ * back the stages in front of it. pop() blocks while it is empty and
+ * returns false once the queue is closed and drained.
+ * Occupancy is sampled on every push for the pipeline report.
+ */
+template <typename T> class BoundedQueue {
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueue_pos;
+  alignas(64) std::atomic<size_t> dequeue_pos;
+  alignas(64) std::atomic<bool> closed;
+  std::atomic<uint64_t> occupancy_sum;
+  std::atomic<uint64_t> occupancy_samples;
+  std::atomic<uint64_t> full_pushes;
+
+  // yield for the first attempts, then sleep so an idle stage does not burn
+  // a core; no busy spinning, which would only steal the time slice of the
+  // thread being waited for when there are fewer cores than threads
+  static void backoff(unsigned &attempt) {
+    if (attempt < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    ++attempt;
+  }
+
+public:
+  // capacity is rounded up to a power of two
+  explicit BoundedQueue(size_t capacity)
+      : mask(0), enqueue_pos(0), dequeue_pos(0), closed(false),
+        occupancy_sum(0), occupancy_samples(0), full_pushes(0) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mask = size - 1;
+  }
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  // moves value in and returns true, or returns false if the queue is full
+  bool try_push(T &value) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells[pos & mask];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          cell.data = std::move(value);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // moves the oldest item into value and returns true, or returns false if
+  // the queue is empty
+  bool try_pop(T &value) {
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells[pos & mask];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          value = std::move(cell.data);
+          cell.sequence.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void push(T value, StageStats *stats = nullptr) {
+    occupancy_sum.fetch_add(size(), std::memory_order_relaxed);
+    occupancy_samples.fetch_add(1, std::memory_order_relaxed);
+    if (try_push(value)) {
+      return;
+    }
+    full_pushes.fetch_add(1, std::memory_order_relaxed);
+    uint64_t start = StageStats::now_ns();
+    for (unsigned attempt = 0; !try_push(value);) {
+      backoff(attempt);
+    }
+    if (stats) {
+      stats->blocked_ns += StageStats::now_ns() - start;
+    }
+  }
+
+  bool pop(T &value, StageStats *stats = nullptr) {
+    if (try_pop(value)) {
+      return true;
+    }
+    uint64_t start = StageStats::now_ns();
+    bool popped = false;
+    for (unsigned attempt = 0;; backoff(attempt)) {
+      // read closed first: a push made before close() is then visible
+      bool done = closed.load(std::memory_order_acquire);
+      if (try_pop(value)) {
+        popped = true;
+        break;
+      }
+      if (done) {
+        break;
+      }
+    }
+    if (stats) {
+      stats->starved_ns += StageStats::now_ns() - start;
+    }
+    return popped;
+  }
+
+  // no more pushes; consumers drain what is left and then stop
+  void close() { closed.store(true, std::memory_order_release); }
+
+  size_t size() const {
+    size_t tail = dequeue_pos.load(std::memory_order_relaxed);
+    size_t head = enqueue_pos.load(std::memory_order_relaxed);
+    return head > tail ? head - tail : 0;
+  }
+  size_t capacity() const { return mask + 1; }
+  double average_occupancy() const {
+    uint64_t samples = occupancy_samples.load(std::memory_order_relaxed);
+    return samples ? (double)occupancy_sum.load(std::memory_order_relaxed) /
+                         samples / capacity()
+                   : 0.0;
+  }
+  uint64_t get_full_pushes() const {
+    return full_pushes.load(std::memory_order_relaxed);
+  }
+};
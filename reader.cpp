@@ -0,0 +1,116 @@
+#include "reader.h"
+#include <algorithm>
+#include <stdexcept>
+
+/*
+ * SegmentReader constructor
+ */
+SegmentReader::SegmentReader(Directory *directory, Codec *codec,
+                             const std::string &segment_name,
+                             segment_id_t segment_id,
+                             const std::vector<std::string> &field_names)
+    : segment_name(segment_name), segment_id(segment_id) {
+  for (const auto &field_name : field_names) {
+    fields.emplace_back(field_name, codec->decode_term_dictionary(
+                                        directory, segment_name, field_name));
+  }
+  std::sort(fields.begin(), fields.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+}
+/*
+ * SegmentReader destructor
+ */
+SegmentReader::~SegmentReader() = default;
+
+std::vector<std::string> SegmentReader::get_field_names() const {
+  std::vector<std::string> names;
+  for (const auto &field : fields) {
+    names.push_back(field.first);
+  }
+  return names;
+}
+
+const FieldReader *SegmentReader::get_field(std::string_view field_name) const {
+  auto it = std::lower_bound(
+      fields.begin(), fields.end(), field_name,
+      [](const auto &field, std::string_view name) { return field.first < name; });
+  if (it == fields.end() || it->first != field_name) {
+    return nullptr;
+  }
+  return it->second.get();
+}
+
+/*
+ * IndexReader constructor
+ */
+IndexReader::IndexReader(Directory *directory, Codec *codec)
+    : directory(directory), codec(codec), generation(0) {
+  // a commit may replace the one being opened and delete its files: then
+  // open the new one
+  for (;;) {
+    generation = SegmentsFile::latest_generation(directory->list_files());
+    if (generation == 0) {
+      throw std::runtime_error("No commit in index directory");
+    }
+    try {
+      auto infos = SegmentsFile::read(directory, generation);
+      std::sort(infos.begin(), infos.end(), [](const auto &a, const auto &b) {
+        return a.get_segment_id() < b.get_segment_id();
+      });
+      segments.clear();
+      for (const auto &info : infos) {
+        segments.push_back(std::make_unique<SegmentReader>(
+            directory, codec, info.get_name(), info.get_segment_id(),
+            info.get_field_names()));
+      }
+      return;
+    } catch (const std::runtime_error &) {
+      if (SegmentsFile::latest_generation(directory->list_files()) ==
+          generation) {
+        throw;
+      }
+    }
+  }
+}
+/*
+ * IndexReader destructor
+ */
+IndexReader::~IndexReader() = default;
+
+uint64_t IndexReader::doc_freq(std::string_view field_name,
+                               std::string_view term) const {
+  uint64_t total = 0;
+  TermInfo info;
+  for (const auto &segment : segments) {
+    const FieldReader *field = segment->get_field(field_name);
+    if (field && field->get_terms().seek_exact(term, info)) {
+      total += info.doc_freq;
+    }
+  }
+  return total;
+}
+
+FieldStats IndexReader::field_stats(std::string_view field_name) const {
+  FieldStats stats;
+  for (const auto &segment : segments) {
+    if (const FieldReader *field = segment->get_field(field_name)) {
+      stats.doc_count += field->get_doc_count();
+      stats.sum_total_term_freq += field->get_sum_total_term_freq();
+    }
+  }
+  return stats;
+}
+
+std::vector<PostingsIterator>
+IndexReader::postings(std::string_view field_name,
+                      std::string_view term) const {
+  std::vector<PostingsIterator> iterators;
+  TermInfo info;
+  for (const auto &segment : segments) {
+    const FieldReader *field = segment->get_field(field_name);
+    if (field && field->get_terms().seek_exact(term, info)) {
+      iterators.push_back(field->postings(info));
+    }
+  }
+  return iterators;
+}
@@ -0,0 +1,74 @@
+// read side of an index directory
+#pragma once
+
+#include "codec.h"
+#include "index.h"
+#include "terms.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+ * SegmentReader is one committed segment of the index. The files of all
+ * its fields are mapped when it is opened, so they stay readable after a
+ * later commit deletes them; what a FieldReader decodes waits for the
+ * first lookup that needs it.
+ */
+class SegmentReader {
+  std::string segment_name;
+  segment_id_t segment_id;
+  // sorted by name
+  std::vector<std::pair<std::string, std::unique_ptr<FieldReader>>> fields;
+
+public:
+  SegmentReader(Directory *directory, Codec *codec,
+                const std::string &segment_name, segment_id_t segment_id,
+                const std::vector<std::string> &field_names);
+  ~SegmentReader();
+  const std::string &get_segment_name() const { return segment_name; }
+  const segment_id_t &get_segment_id() const { return segment_id; }
+  std::vector<std::string> get_field_names() const;
+  // the field's reader, or nullptr if the segment has no such field
+  const FieldReader *get_field(std::string_view field_name) const;
+};
+
+// statistics of a field over all segments
+struct FieldStats {
+  uint64_t doc_count = 0;           // docs with the field
+  uint64_t sum_total_term_freq = 0; // terms in all of them
+};
+
+/*
+ * IndexReader opens the last commit of an index directory written by
+ * IndexWriter with a codec that can read it back (BinaryCodec): the
+ * segments listed by its segments_<generation>, and nothing written since.
+ * Opening only maps their files, so it takes a few milliseconds whatever
+ * the size of the index; terms and postings are read from the mapped files
+ * when a lookup needs them. Docids are global: every segment holds a
+ * disjoint set of them, not a range. One IndexReader may be shared by any
+ * number of threads.
+ */
+class IndexReader {
+  Directory *directory; // not owned
+  Codec *codec;         // not owned
+  uint64_t generation;
+  std::vector<std::unique_ptr<SegmentReader>> segments; // by segment id
+
+public:
+  IndexReader(Directory *directory, Codec *codec);
+  ~IndexReader();
+  // of the commit opened
+  uint64_t get_generation() const { return generation; }
+  const std::vector<std::unique_ptr<SegmentReader>> &get_segments() const {
+    return segments;
+  }
+  // number of docs containing term, over all segments
+  uint64_t doc_freq(std::string_view field_name, std::string_view term) const;
+  FieldStats field_stats(std::string_view field_name) const;
+  // the term's postings in every segment that has it
+  std::vector<PostingsIterator> postings(std::string_view field_name,
+                                         std::string_view term) const;
+};
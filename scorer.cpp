@@ -0,0 +1,378 @@
+#include "scorer.h"
+#include "query.h"
+#include <algorithm>
+#include <cmath>
+
+/*
+ * BM25 constructor
+ */
+BM25::BM25(uint64_t doc_count, uint64_t sum_total_term_freq,
+           uint64_t doc_freq) {
+  idf = (float)std::log(1 + ((double)doc_count - (double)doc_freq + 0.5) /
+                                ((double)doc_freq + 0.5));
+  double average_length =
+      doc_count ? (double)sum_total_term_freq / (double)doc_count : 1;
+  for (int norm = 0; norm < 256; ++norm) {
+    length_norms[norm] =
+        (float)(K1 * (1 - B + B * (double)decode_norm((uint8_t)norm) /
+                                  average_length));
+  }
+}
+
+float BM25::max_score(const Impact &impact) const {
+  if (impact.max_freq == 0) {
+    return 0;
+  }
+  // the bounds of several terms are summed and compared with sums of their
+  // scores, rounded in another order
+  return score(impact.max_freq, impact.min_norm) * (1 + 1e-5f);
+}
+
+/*
+ * BM25F constructor
+ */
+BM25F::BM25F(const std::vector<FieldBoost> &fields,
+             const std::vector<FieldStats> &stats,
+             const std::vector<uint64_t> &doc_freqs)
+    : field_norms(fields.size()) {
+  uint64_t doc_count = 0;
+  uint64_t doc_freq = 0;
+  for (std::size_t field = 0; field < fields.size(); ++field) {
+    doc_count = std::max(doc_count, stats[field].doc_count);
+    doc_freq = std::max(doc_freq, doc_freqs[field]);
+    double average_length =
+        stats[field].doc_count ? (double)stats[field].sum_total_term_freq /
+                                     (double)stats[field].doc_count
+                               : 1;
+    for (int norm = 0; norm < 256; ++norm) {
+      field_norms[field][norm] =
+          (float)(fields[field].boost /
+                  (1 - BM25::B +
+                   BM25::B * (double)decode_norm((uint8_t)norm) /
+                       average_length));
+    }
+  }
+  idf = (float)std::log(1 + ((double)doc_count - (double)doc_freq + 0.5) /
+                                ((double)doc_freq + 0.5));
+}
+
+float BM25F::max_score(float pseudo_freq) const {
+  return pseudo_freq > 0 ? score(pseudo_freq * (1 + 1e-5f)) * (1 + 1e-5f) : 0;
+}
+
+/*
+ * Scorer constructor
+ */
+Scorer::Scorer(std::size_t ord) : ord(ord) {}
+/*
+ * Scorer destructor
+ */
+Scorer::~Scorer() = default;
+
+/*
+ * TermScorer constructor
+ */
+TermScorer::TermScorer(const FieldReader *field, const TermInfo &info,
+                       const BM25 *bm25, std::size_t ord)
+    : Scorer(ord), postings(field->postings(info)), field(field), bm25(bm25),
+      max(bm25->max_score(field->max_impact(info))), block_loaded(false),
+      block_end(0), block_max(0) {
+  if (!postings.has_skip_data()) {
+    // a single block
+    block_loaded = true;
+    block_end = PostingsIterator::NoMoreDocs;
+    block_max = max;
+  }
+}
+
+docid_t TermScorer::load_block(docid_t target) {
+  Impact impact;
+  block_end = postings.shallow_advance(target, impact);
+  block_max = bm25->max_score(impact);
+  block_loaded = true;
+  return block_end;
+}
+
+/*
+ * CombinedFieldScorer constructor
+ */
+CombinedFieldScorer::CombinedFieldScorer(
+    const std::vector<std::tuple<std::size_t, const FieldReader *, TermInfo>>
+        &fields,
+    const BM25F *bm25f, std::size_t ord)
+    : Scorer(ord), bm25f(bm25f), started(false),
+      current(PostingsIterator::NoMoreDocs), block_loaded(false),
+      block_end(0), block_max(0) {
+  float pseudo_freq = 0;
+  this->fields.reserve(fields.size());
+  for (const auto &[field, reader, info] : fields) {
+    Impact impact = reader->max_impact(info);
+    this->fields.push_back(
+        {field, reader, reader->postings(info), impact, 0, Impact()});
+    pseudo_freq += bm25f->pseudo_freq(field, impact.max_freq, impact.min_norm);
+  }
+  max = bm25f->max_score(pseudo_freq);
+}
+
+docid_t CombinedFieldScorer::lowest() {
+  current = PostingsIterator::NoMoreDocs;
+  for (const auto &field : fields) {
+    current = std::min(current, field.postings.docid());
+  }
+  return current;
+}
+docid_t CombinedFieldScorer::next_doc() {
+  for (auto &field : fields) {
+    if (!started || field.postings.docid() == current) {
+      field.postings.next_doc();
+    }
+  }
+  started = true;
+  return lowest();
+}
+docid_t CombinedFieldScorer::advance(docid_t target) {
+  if (started && current >= target) {
+    return current;
+  }
+  for (auto &field : fields) {
+    field.postings.advance(target);
+  }
+  started = true;
+  return lowest();
+}
+float CombinedFieldScorer::score() const {
+  float pseudo_freq = 0;
+  for (const auto &field : fields) {
+    if (field.postings.docid() == current) {
+      pseudo_freq += bm25f->pseudo_freq(field.field, field.postings.freq(),
+                                        field.reader->norm(current));
+    }
+  }
+  return bm25f->score(pseudo_freq);
+}
+
+docid_t CombinedFieldScorer::advance_shallow(docid_t target) {
+  if (block_loaded && target <= block_end) {
+    return block_end;
+  }
+  block_end = PostingsIterator::NoMoreDocs;
+  float pseudo_freq = 0;
+  for (auto &field : fields) {
+    if (!field.postings.has_skip_data()) {
+      field.block_end = PostingsIterator::NoMoreDocs;
+      field.block_impact = field.max_impact;
+    } else if (!block_loaded || target > field.block_end) {
+      field.block_end = field.postings.shallow_advance(target, field.block_impact);
+    }
+    block_end = std::min(block_end, field.block_end);
+    pseudo_freq += bm25f->pseudo_freq(field.field, field.block_impact.max_freq,
+                                      field.block_impact.min_norm);
+  }
+  block_max = bm25f->max_score(pseudo_freq);
+  block_loaded = true;
+  return block_end;
+}
+
+Weight::~Weight() = default;
+
+// the statistics BM25 needs
+static BM25 term_bm25(const IndexReader &reader, const std::string &field,
+                      const std::string &term) {
+  FieldStats stats = reader.field_stats(field);
+  return BM25(stats.doc_count, stats.sum_total_term_freq,
+              reader.doc_freq(field, term));
+}
+
+/*
+ * TermWeight constructor
+ */
+TermWeight::TermWeight(const IndexReader &reader, const std::string &field,
+                       const std::string &term)
+    : field(field), term(term), bm25(term_bm25(reader, field, term)) {}
+
+std::unique_ptr<Scorer> TermWeight::scorer(const SegmentReader &segment,
+                                           std::size_t ord) const {
+  const FieldReader *field_reader = segment.get_field(field);
+  TermInfo info;
+  if (!field_reader || !field_reader->get_terms().seek_exact(term, info)) {
+    return nullptr;
+  }
+  return std::make_unique<TermScorer>(field_reader, info, &bm25, ord);
+}
+
+// the statistics BM25F needs, per field
+static BM25F combined_bm25f(const IndexReader &reader,
+                            const std::vector<FieldBoost> &fields,
+                            const std::string &term) {
+  std::vector<FieldStats> stats;
+  std::vector<uint64_t> doc_freqs;
+  for (const auto &field : fields) {
+    stats.push_back(reader.field_stats(field.field));
+    doc_freqs.push_back(reader.doc_freq(field.field, term));
+  }
+  return BM25F(fields, stats, doc_freqs);
+}
+
+/*
+ * CombinedFieldWeight constructor
+ */
+CombinedFieldWeight::CombinedFieldWeight(const IndexReader &reader,
+                                         const std::vector<FieldBoost> &fields,
+                                         const std::string &term)
+    : fields(fields), term(term), bm25f(combined_bm25f(reader, fields, term)) {}
+
+std::unique_ptr<Scorer>
+CombinedFieldWeight::scorer(const SegmentReader &segment,
+                            std::size_t ord) const {
+  std::vector<std::tuple<std::size_t, const FieldReader *, TermInfo>> found;
+  TermInfo info;
+  for (std::size_t i = 0; i < fields.size(); ++i) {
+    const FieldReader *field_reader = segment.get_field(fields[i].field);
+    if (field_reader && field_reader->get_terms().seek_exact(term, info)) {
+      found.emplace_back(i, field_reader, info);
+    }
+  }
+  if (found.empty()) {
+    return nullptr;
+  }
+  return std::make_unique<CombinedFieldScorer>(found, &bm25f, ord);
+}
+
+// better first: higher score, then lower docid
+static bool better(const ScoreDoc &a, const ScoreDoc &b) {
+  return a.score > b.score || (a.score == b.score && a.docid < b.docid);
+}
+
+/*
+ * TopKCollector constructor
+ */
+TopKCollector::TopKCollector(std::size_t k) : k(k) { heap.reserve(k); }
+
+void TopKCollector::collect(docid_t docid, float score) {
+  ScoreDoc doc{docid, score};
+  if (heap.size() < k) {
+    heap.push_back(doc);
+    std::push_heap(heap.begin(), heap.end(), better);
+  } else if (k > 0 && better(doc, heap.front())) {
+    std::pop_heap(heap.begin(), heap.end(), better);
+    heap.back() = doc;
+    std::push_heap(heap.begin(), heap.end(), better);
+  }
+}
+
+float TopKCollector::threshold() const {
+  if (k == 0) {
+    return INFINITY;
+  }
+  return heap.size() < k ? 0 : heap.front().score;
+}
+
+std::vector<ScoreDoc> TopKCollector::top() const {
+  std::vector<ScoreDoc> docs = heap;
+  std::sort(docs.begin(), docs.end(), better);
+  return docs;
+}
+
+void score_exhaustive(DocIterator &matches,
+                      const std::vector<Scorer *> &scorers,
+                      TopKCollector &collector) {
+  std::vector<Scorer *> by_ord = scorers;
+  std::sort(by_ord.begin(), by_ord.end(),
+            [](Scorer *a, Scorer *b) {
+              return a->get_ord() < b->get_ord();
+            });
+  for (docid_t doc = matches.next_doc(); doc != DocIterator::NoMoreDocs;
+       doc = matches.next_doc()) {
+    float score = 0;
+    for (Scorer *scorer : by_ord) {
+      if (scorer->advance(doc) == doc) {
+        score += scorer->score();
+      }
+    }
+    collector.collect(doc, score);
+  }
+}
+
+void score_wand(const std::vector<Scorer *> &scorers, bool block_max,
+                TopKCollector &collector) {
+  std::vector<Scorer *> lists;
+  for (Scorer *scorer : scorers) {
+    if (scorer->next_doc() != DocIterator::NoMoreDocs) {
+      lists.push_back(scorer);
+    }
+  }
+  std::vector<Scorer *> matched;
+  auto by_doc = [](Scorer *a, Scorer *b) {
+    return a->docid() < b->docid();
+  };
+  for (;;) {
+    std::sort(lists.begin(), lists.end(), by_doc);
+    while (!lists.empty() && lists.back()->docid() == DocIterator::NoMoreDocs) {
+      lists.pop_back();
+    }
+    // the first doc whose terms can reach the threshold
+    float threshold = collector.threshold();
+    float bound = 0;
+    std::size_t pivot = 0;
+    while (pivot < lists.size()) {
+      bound += lists[pivot]->max_score();
+      if (bound >= threshold) {
+        break;
+      }
+      ++pivot;
+    }
+    if (pivot == lists.size()) {
+      return;
+    }
+    docid_t pivot_doc = lists[pivot]->docid();
+    while (pivot + 1 < lists.size() && lists[pivot + 1]->docid() == pivot_doc) {
+      ++pivot;
+    }
+
+    if (block_max) {
+      float block_bound = 0;
+      docid_t block_end = DocIterator::NoMoreDocs;
+      for (std::size_t i = 0; i <= pivot; ++i) {
+        block_end = std::min(block_end, lists[i]->advance_shallow(pivot_doc));
+        block_bound += lists[i]->block_max_score();
+      }
+      if (block_bound < threshold) {
+        // Docs before the pivot cannot reach the threshold, and up to the
+        // end of the shortest block neither can the ones with the pivot's
+        // terms: skip to the first doc where either may change.
+        docid_t target = block_end == DocIterator::NoMoreDocs
+                             ? block_end
+                             : block_end + 1;
+        if (pivot + 1 < lists.size()) {
+          target = std::min(target, lists[pivot + 1]->docid());
+        }
+        for (std::size_t i = 0; i <= pivot; ++i) {
+          lists[i]->advance(target);
+        }
+        continue;
+      }
+    }
+
+    if (lists[0]->docid() == pivot_doc) {
+      // every term up to the pivot is on it, sum them in query order
+      matched.assign(lists.begin(), lists.begin() + pivot + 1);
+      std::sort(matched.begin(), matched.end(),
+                [](Scorer *a, Scorer *b) {
+                  return a->get_ord() < b->get_ord();
+                });
+      float score = 0;
+      for (Scorer *scorer : matched) {
+        score += scorer->score();
+      }
+      collector.collect(pivot_doc, score);
+      for (std::size_t i = 0; i <= pivot; ++i) {
+        lists[i]->next_doc();
+      }
+    } else {
+      for (std::size_t i = 0; i < pivot && lists[i]->docid() < pivot_doc;
+           ++i) {
+        lists[i]->advance(pivot_doc);
+      }
+    }
+  }
+}
@@ -0,0 +1,249 @@
+// BM25 scoring and top-k retrieval with dynamic pruning
+#pragma once
+
+#include "codec.h"
+#include "reader.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+class DocIterator;
+
+/*
+ * BM25 of one term of a field, with index-wide statistics:
+ *   idf * freq * (k1 + 1) / (freq + k1 * (1 - b + b * length / avgdl))
+ *   idf = log(1 + (doc_count - doc_freq + 0.5) / (doc_freq + 0.5))
+ * The length part is precomputed for the 256 norms.
+ */
+class BM25 {
+  float idf;
+  float length_norms[256];
+
+public:
+  static constexpr float K1 = 1.2f;
+  static constexpr float B = 0.75f;
+
+  BM25(uint64_t doc_count, uint64_t sum_total_term_freq, uint64_t doc_freq);
+  float score(uint32_t freq, uint8_t norm) const {
+    return idf * (float)freq * (K1 + 1) / ((float)freq + length_norms[norm]);
+  }
+  // at least score() of any doc with that impact, float rounding included
+  float max_score(const Impact &impact) const;
+};
+
+// a field searched by a query, and how much its matches weigh
+struct FieldBoost {
+  std::string field;
+  float boost = 1;
+};
+
+/*
+ * BM25F of one term over several fields: the freqs of the fields are
+ * normalized by their own length and weighted by their boost into one
+ * pseudo freq, which then saturates once, as in BM25:
+ *   freq~ = sum of boost * freq / (1 - b + b * length / avgdl) per field
+ *   idf * freq~ * (k1 + 1) / (k1 + freq~)
+ * The docs with the term in any of the fields are not counted, so the idf
+ * takes the largest doc_freq and doc_count among the fields.
+ */
+class BM25F {
+  float idf;
+  std::vector<std::array<float, 256>> field_norms; // boost / length part
+
+public:
+  BM25F(const std::vector<FieldBoost> &fields,
+        const std::vector<FieldStats> &stats,
+        const std::vector<uint64_t> &doc_freqs);
+  // the part of field in freq~
+  float pseudo_freq(std::size_t field, uint32_t freq, uint8_t norm) const {
+    return (float)freq * field_norms[field][norm];
+  }
+  float score(float pseudo_freq) const {
+    return idf * pseudo_freq * (BM25::K1 + 1) / (BM25::K1 + pseudo_freq);
+  }
+  // at least score() of the pseudo freq of any doc within the impacts it
+  // was summed from
+  float max_score(float pseudo_freq) const;
+};
+
+/*
+ * Scorer walks the docs of one scored leaf of a query in one segment, and
+ * bounds the scores it gives: overall, and in the block holding a target
+ * doc from the impacts in the skip data.
+ */
+class Scorer {
+  std::size_t ord; // of the leaf in the query
+
+public:
+  Scorer(std::size_t ord);
+  virtual ~Scorer();
+  std::size_t get_ord() const { return ord; }
+  virtual docid_t next_doc() = 0;
+  virtual docid_t advance(docid_t target) = 0;
+  virtual docid_t docid() const = 0;
+  virtual float score() const = 0;
+  virtual float max_score() const = 0;
+  /*
+   * Bounds the docs from target to the end of its block: returns the
+   * block's last doc and block_max_score() then gives the bound. Targets
+   * must not decrease.
+   */
+  virtual docid_t advance_shallow(docid_t target) = 0;
+  virtual float block_max_score() const = 0;
+};
+
+/*
+ * TermScorer scores the docs of one term of one field with BM25. Terms
+ * without skip data have a single block.
+ */
+class TermScorer : public Scorer {
+  PostingsIterator postings;
+  const FieldReader *field; // not owned
+  const BM25 *bm25;         // not owned
+  float max;
+  bool block_loaded;
+  docid_t block_end; // last doc block_max bounds, NoMoreDocs past the end
+  float block_max;
+  docid_t load_block(docid_t target);
+
+public:
+  TermScorer(const FieldReader *field, const TermInfo &info, const BM25 *bm25,
+             std::size_t ord);
+  docid_t next_doc() override { return postings.next_doc(); }
+  docid_t advance(docid_t target) override { return postings.advance(target); }
+  docid_t docid() const override { return postings.docid(); }
+  float score() const override {
+    return bm25->score(postings.freq(), field->norm(postings.docid()));
+  }
+  float max_score() const override { return max; }
+  docid_t advance_shallow(docid_t target) override {
+    return block_loaded && target <= block_end ? block_end
+                                               : load_block(target);
+  }
+  float block_max_score() const override { return block_max; }
+};
+
+/*
+ * CombinedFieldScorer scores the docs of one term in any of several fields
+ * with BM25F. It walks the postings of every field that has the term and
+ * sits on the lowest doc among them; its blocks end where the first of
+ * theirs does.
+ */
+class CombinedFieldScorer : public Scorer {
+  struct FieldPostings {
+    std::size_t field; // in BM25F
+    const FieldReader *reader;
+    PostingsIterator postings;
+    Impact max_impact;
+    docid_t block_end;
+    Impact block_impact;
+  };
+  std::vector<FieldPostings> fields;
+  const BM25F *bm25f; // not owned
+  bool started;
+  docid_t current;
+  float max;
+  bool block_loaded;
+  docid_t block_end;
+  float block_max;
+  docid_t lowest();
+
+public:
+  // per field with the term: its number in BM25F, reader and TermInfo
+  CombinedFieldScorer(
+      const std::vector<std::tuple<std::size_t, const FieldReader *,
+                                   TermInfo>> &fields,
+      const BM25F *bm25f, std::size_t ord);
+  docid_t next_doc() override;
+  docid_t advance(docid_t target) override;
+  docid_t docid() const override { return current; }
+  float score() const override;
+  float max_score() const override { return max; }
+  docid_t advance_shallow(docid_t target) override;
+  float block_max_score() const override { return block_max; }
+};
+
+/*
+ * Weight is a scored leaf of a query with the statistics of the whole
+ * index: it creates the leaf's Scorer in every segment.
+ */
+class Weight {
+public:
+  virtual ~Weight();
+  // nullptr if the leaf matches nothing in segment
+  virtual std::unique_ptr<Scorer> scorer(const SegmentReader &segment,
+                                         std::size_t ord) const = 0;
+};
+
+class TermWeight : public Weight {
+  std::string field;
+  std::string term;
+  BM25 bm25;
+
+public:
+  TermWeight(const IndexReader &reader, const std::string &field,
+             const std::string &term);
+  std::unique_ptr<Scorer> scorer(const SegmentReader &segment,
+                                 std::size_t ord) const override;
+};
+
+class CombinedFieldWeight : public Weight {
+  std::vector<FieldBoost> fields;
+  std::string term;
+  BM25F bm25f;
+
+public:
+  CombinedFieldWeight(const IndexReader &reader,
+                      const std::vector<FieldBoost> &fields,
+                      const std::string &term);
+  std::unique_ptr<Scorer> scorer(const SegmentReader &segment,
+                                 std::size_t ord) const override;
+};
+
+struct ScoreDoc {
+  docid_t docid;
+  float score;
+};
+
+/*
+ * TopKCollector keeps the k best docs seen, by score and then by lowest
+ * docid, in a heap with the worst on top.
+ */
+class TopKCollector {
+  std::size_t k;
+  std::vector<ScoreDoc> heap;
+
+public:
+  TopKCollector(std::size_t k);
+  void collect(docid_t docid, float score);
+  // a doc scoring below this cannot enter, 0 until k docs are collected
+  float threshold() const;
+  // best first
+  std::vector<ScoreDoc> top() const;
+};
+
+enum class ScoreMode { Exhaustive, WAND, BlockMaxWAND };
+
+/*
+ * Score every doc of matches with the scorers on it, in order of ord so
+ * that the sum does not depend on the evaluation order.
+ */
+void score_exhaustive(DocIterator &matches,
+                      const std::vector<Scorer *> &scorers,
+                      TopKCollector &collector);
+
+/*
+ * Collect the top docs of a disjunction of scorers with WAND: they are
+ * kept sorted by current doc, and the first doc whose scorers' maximum
+ * scores add up to the collector's threshold, the pivot, is the next one
+ * worth scoring; the scorers before it advance straight to it. With
+ * block_max, Block-Max WAND then also sums the bounds of the blocks
+ * holding the pivot, and if they fall short every scorer up to the pivot
+ * skips past the end of the first of those blocks.
+ */
+void score_wand(const std::vector<Scorer *> &scorers, bool block_max,
+                TopKCollector &collector);
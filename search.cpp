@@ -0,0 +1,114 @@
+#include "codec.h"
+#include "index.h"
+#include "query.h"
+#include "reader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// Fields searched by terms without a field: prefix, as field^boost,...
+const char *DefaultFields = "body";
+// Docids printed per query without ranking.
+const size_t MaxPrinted = 10;
+
+// "body,title^3" to {body 1, title 3}
+static std::vector<FieldBoost> parse_fields(const std::string &list) {
+  std::vector<FieldBoost> fields;
+  std::size_t start = 0;
+  while (start <= list.size()) {
+    std::size_t end = std::min(list.find(',', start), list.size());
+    std::string item = list.substr(start, end - start);
+    std::size_t caret = item.find('^');
+    FieldBoost field{item.substr(0, caret)};
+    if (caret != std::string::npos) {
+      field.boost = std::stof(item.substr(caret + 1));
+    }
+    if (field.field.empty() || !(field.boost > 0)) {
+      throw std::runtime_error("Bad field " + item + " in " + list);
+    }
+    fields.push_back(field);
+    start = end + 1;
+  }
+  return fields;
+}
+
+int main(int argc, char *argv[]) {
+  size_t top = 10;
+  std::string mode = "bmw";
+  std::string default_fields = DefaultFields;
+  std::string directory_type = "local";
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1]; arg += 2) {
+    std::string option = argv[arg];
+    if (option == "-k") {
+      top = std::max(1, std::stoi(argv[arg + 1]));
+    } else if (option == "-m") {
+      mode = argv[arg + 1];
+    } else if (option == "-f") {
+      default_fields = argv[arg + 1];
+    } else if (option == "-d") {
+      directory_type = argv[arg + 1];
+    } else {
+      break;
+    }
+  }
+  if (argc - arg < 2 ||
+      (mode != "match" && mode != "exhaustive" && mode != "wand" &&
+       mode != "bmw") ||
+      (directory_type != "local" && directory_type != "ram")) {
+    std::cerr << "Usage: " << argv[0]
+              << " [-k top] [-m match|exhaustive|wand|bmw]"
+                 " [-f field^boost,...] [-d local|ram] <index_dir> <query>..."
+              << std::endl;
+    return 1;
+  }
+  try {
+    std::vector<FieldBoost> fields = parse_fields(default_fields);
+    // ram: the whole index is read into memory first
+    std::unique_ptr<Directory> directory =
+        std::make_unique<LocalDirectory>(argv[arg], false);
+    if (directory_type == "ram") {
+      directory = std::make_unique<RAMDirectory>(directory.get());
+    }
+    BinaryCodec codec;
+    IndexReader reader(directory.get(), &codec);
+    IndexSearcher searcher(&reader);
+    ScoreMode score_mode = mode == "exhaustive" ? ScoreMode::Exhaustive
+                           : mode == "wand"     ? ScoreMode::WAND
+                                                : ScoreMode::BlockMaxWAND;
+    for (++arg; arg < argc; ++arg) {
+      auto query = Query::parse(argv[arg], fields);
+      auto start = std::chrono::steady_clock::now();
+      std::vector<docid_t> docids;
+      std::vector<ScoreDoc> hits;
+      if (mode == "match") {
+        docids = searcher.search(*query);
+      } else {
+        hits = searcher.search(*query, top, score_mode);
+      }
+      double ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      std::cout << query->to_string() << ": ";
+      if (mode == "match") {
+        std::cout << docids.size() << " docs in " << ms << " ms";
+        for (size_t i = 0; i < docids.size() && i < MaxPrinted; ++i) {
+          std::cout << " d" << docids[i];
+        }
+      } else {
+        std::cout << "top " << hits.size() << " in " << ms << " ms";
+        for (const ScoreDoc &hit : hits) {
+          std::cout << " d" << hit.docid << "=" << hit.score;
+        }
+      }
+      std::cout << std::endl;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
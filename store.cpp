@@ -0,0 +1,351 @@
+#include "store.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <stdexcept>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_CRC32_INSTRUCTION 1
+#endif
+
+// CRC-32C, reflected polynomial
+static constexpr uint32_t Castagnoli = 0x82f63b78;
+
+static const std::array<uint32_t, 256> crc_table = [] {
+  std::array<uint32_t, 256> table;
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = crc & 1 ? (crc >> 1) ^ Castagnoli : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+static uint32_t crc32c_portable(uint32_t crc, const uint8_t *data,
+                                std::size_t length) {
+  for (std::size_t i = 0; i < length; ++i) {
+    crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef HAVE_CRC32_INSTRUCTION
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *data, std::size_t length) {
+  uint64_t crc64 = crc;
+  for (; length >= 8; data += 8, length -= 8) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (uint32_t)crc64;
+  for (; length > 0; ++data, --length) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+  return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, std::size_t length) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+#ifdef HAVE_CRC32_INSTRUCTION
+  static const bool hardware = __builtin_cpu_supports("sse4.2");
+  if (hardware) {
+    return ~crc32c_sse42(crc, bytes, length);
+  }
+#endif
+  return ~crc32c_portable(crc, bytes, length);
+}
+
+static uint32_t load_u32le(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+void check_footer(const std::string &name, const char *data, std::size_t size) {
+  if (size < FooterLength ||
+      std::memcmp(data + size - FooterLength, FooterMagic, 4) != 0) {
+    throw std::runtime_error("Missing footer in " + name);
+  }
+  uint32_t expected =
+      load_u32le((const uint8_t *)data + size - FooterLength + 4);
+  if (crc32c(0, data, size - FooterLength + 4) != expected) {
+    throw std::runtime_error("Checksum mismatch in " + name);
+  }
+}
+
+static uint8_t *allocate_buffer() {
+  void *buffer = std::aligned_alloc(IndexOutput::BufferAlignment,
+                                    IndexOutput::BufferSize);
+  if (!buffer) {
+    throw std::bad_alloc();
+  }
+  return static_cast<uint8_t *>(buffer);
+}
+
+// IndexOutput
+
+/*
+ * IndexOutput constructor
+ */
+IndexOutput::IndexOutput(const std::string &name)
+    : name(name), buffer(allocate_buffer()), buffered(0), flushed(0),
+      crc(0) {}
+/*
+ * IndexOutput destructor
+ */
+IndexOutput::~IndexOutput() { std::free(buffer); }
+
+void IndexOutput::flush_buffer() {
+  if (buffered == 0) {
+    return;
+  }
+  write_at(flushed, buffer, buffered);
+  crc = crc32c(crc, buffer, buffered);
+  flushed += buffered;
+  buffered = 0;
+}
+
+void IndexOutput::write_bytes(const void *data, std::size_t length) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  while (length > 0) {
+    if (buffered == BufferSize) {
+      flush_buffer();
+    }
+    std::size_t chunk = std::min(length, BufferSize - buffered);
+    std::memcpy(buffer + buffered, bytes, chunk);
+    buffered += chunk;
+    bytes += chunk;
+    length -= chunk;
+  }
+}
+
+void IndexOutput::write_vint(uint64_t value) {
+  while (value >= 0x80) {
+    write_byte((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  write_byte((uint8_t)value);
+}
+
+void IndexOutput::write_u64(uint64_t value) {
+  for (int i = 0; i < 8; ++i) {
+    write_byte((uint8_t)(value >> (8 * i)));
+  }
+}
+
+uint32_t IndexOutput::get_checksum() const {
+  return crc32c(crc, buffer, buffered);
+}
+
+void IndexOutput::write_footer() {
+  write_bytes(FooterMagic, 4);
+  uint32_t checksum = get_checksum();
+  for (int i = 0; i < 4; ++i) {
+    write_byte((uint8_t)(checksum >> (8 * i)));
+  }
+}
+
+void IndexOutput::close() { flush_buffer(); }
+
+// IndexInput
+
+/*
+ * IndexInput constructor
+ */
+IndexInput::IndexInput(const std::string &name, uint64_t file_length)
+    : name(name), file_length(file_length), buffer(allocate_buffer()),
+      buffer_start(0), buffered(0), position(0) {}
+/*
+ * IndexInput destructor
+ */
+IndexInput::~IndexInput() { std::free(buffer); }
+
+void IndexInput::refill() {
+  buffer_start += buffered;
+  position = 0;
+  buffered = 0;
+  if (buffer_start >= file_length) {
+    throw std::runtime_error("Read past the end of " + name);
+  }
+  std::size_t length = (std::size_t)std::min<uint64_t>(
+      IndexOutput::BufferSize, file_length - buffer_start);
+  read_at(buffer_start, buffer, length);
+  buffered = length;
+}
+
+void IndexInput::seek(uint64_t offset) {
+  if (offset > file_length) {
+    throw std::runtime_error("Seek past the end of " + name);
+  }
+  if (offset >= buffer_start && offset <= buffer_start + buffered) {
+    position = offset - buffer_start;
+    return;
+  }
+  buffer_start = offset;
+  buffered = 0;
+  position = 0;
+}
+
+void IndexInput::read_bytes(void *data, std::size_t length) {
+  uint8_t *bytes = static_cast<uint8_t *>(data);
+  while (length > 0) {
+    if (position == buffered) {
+      refill();
+    }
+    std::size_t chunk = std::min(length, buffered - position);
+    std::memcpy(bytes, buffer + position, chunk);
+    position += chunk;
+    bytes += chunk;
+    length -= chunk;
+  }
+}
+
+uint64_t IndexInput::read_vint() {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte = read_byte();
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  throw std::runtime_error("Malformed VInt in " + name);
+}
+
+uint64_t IndexInput::read_u64() {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value |= (uint64_t)read_byte() << (8 * i);
+  }
+  return value;
+}
+
+void IndexInput::check_footer() {
+  if (file_length < FooterLength) {
+    throw std::runtime_error("Missing footer in " + name);
+  }
+  uint64_t footer = file_length - FooterLength;
+  uint32_t crc = 0;
+  seek(0);
+  for (uint64_t left = footer + 4; left > 0;) {
+    if (position == buffered) {
+      refill();
+    }
+    std::size_t chunk =
+        (std::size_t)std::min<uint64_t>(left, buffered - position);
+    crc = crc32c(crc, buffer + position, chunk);
+    position += chunk;
+    left -= chunk;
+  }
+  uint8_t stored[FooterLength];
+  seek(footer);
+  read_bytes(stored, FooterLength);
+  seek(footer);
+  if (std::memcmp(stored, FooterMagic, 4) != 0) {
+    throw std::runtime_error("Missing footer in " + name);
+  }
+  if (load_u32le(stored + 4) != crc) {
+    throw std::runtime_error("Checksum mismatch in " + name);
+  }
+}
+
+// FileIndexOutput
+
+/*
+ * FileIndexOutput constructor
+ */
+FileIndexOutput::FileIndexOutput(const std::string &path,
+                                 const std::string &name)
+    : IndexOutput(name),
+      fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) {
+  if (fd < 0) {
+    throw std::runtime_error("Failed to create file: " + path);
+  }
+}
+/*
+ * FileIndexOutput destructor
+ */
+FileIndexOutput::~FileIndexOutput() {
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+void FileIndexOutput::write_at(uint64_t offset, const uint8_t *data,
+                               std::size_t length) {
+  while (length > 0) {
+    ssize_t written = ::pwrite(fd, data, length, (off_t)offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to write file: " + get_name());
+    }
+    data += written;
+    offset += written;
+    length -= written;
+  }
+}
+
+void FileIndexOutput::close() {
+  IndexOutput::close();
+  int result = ::close(fd);
+  fd = -1;
+  if (result != 0) {
+    throw std::runtime_error("Failed to close file: " + get_name());
+  }
+}
+
+// FileIndexInput
+
+static uint64_t file_size(int fd, const std::string &path) {
+  off_t size = fd < 0 ? -1 : ::lseek(fd, 0, SEEK_END);
+  if (size < 0) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    throw std::runtime_error("Failed to open file: " + path);
+  }
+  return (uint64_t)size;
+}
+
+/*
+ * FileIndexInput constructor
+ */
+FileIndexInput::FileIndexInput(const std::string &path,
+                               const std::string &name)
+    : FileIndexInput(::open(path.c_str(), O_RDONLY | O_CLOEXEC), path, name) {}
+
+FileIndexInput::FileIndexInput(int fd, const std::string &path,
+                               const std::string &name)
+    : IndexInput(name, file_size(fd, path)), fd(fd) {}
+/*
+ * FileIndexInput destructor
+ */
+FileIndexInput::~FileIndexInput() { ::close(fd); }
+
+void FileIndexInput::read_at(uint64_t offset, uint8_t *data,
+                             std::size_t length) {
+  while (length > 0) {
+    ssize_t read = ::pread(fd, data, length, (off_t)offset);
+    if (read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (read <= 0) {
+      throw std::runtime_error("Failed to read file: " + get_name());
+    }
+    data += read;
+    offset += read;
+    length -= read;
+  }
+}
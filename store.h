@@ -0,0 +1,146 @@
+// buffered streams over the files of a Directory
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * CRC-32C (Castagnoli) of length bytes at data, continuing from crc, the
+ * value for the bytes before (0 for none). Uses the SSE4.2 instruction when
+ * the CPU has it.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, std::size_t length);
+
+/*
+ * Files written through an IndexOutput may end with a footer: "TLFT", then
+ * the CRC-32C of every byte of the file before it, footer magic included,
+ * as 4 little endian bytes.
+ */
+constexpr const char *FooterMagic = "TLFT";
+constexpr std::size_t FooterLength = 8;
+// checks the footer of a whole file in memory, throws if it does not match
+void check_footer(const std::string &name, const char *data, std::size_t size);
+
+/*
+ * IndexOutput writes a new file from start to end through a buffer of
+ * BufferSize bytes, aligned for the page cache, so the file is written a
+ * large block at a time whatever the size of the values written. It keeps
+ * the checksum of what it wrote. close() writes what is still buffered; an
+ * output destroyed without it, e.g. on an exception, leaves its file
+ * incomplete.
+ */
+class IndexOutput {
+  std::string name;
+  uint8_t *buffer;
+  std::size_t buffered;
+  uint64_t flushed; // bytes before the buffer
+  uint32_t crc;     // of those bytes
+
+protected:
+  // writes length bytes at offset of the file
+  virtual void write_at(uint64_t offset, const uint8_t *data,
+                        std::size_t length) = 0;
+  void flush_buffer();
+
+public:
+  static constexpr std::size_t BufferSize = 64 * 1024;
+  static constexpr std::size_t BufferAlignment = 4096;
+
+  IndexOutput(const std::string &name);
+  IndexOutput(const IndexOutput &) = delete;
+  IndexOutput &operator=(const IndexOutput &) = delete;
+  virtual ~IndexOutput();
+  const std::string &get_name() const { return name; }
+  void write_byte(uint8_t byte) {
+    if (buffered == BufferSize) {
+      flush_buffer();
+    }
+    buffer[buffered++] = byte;
+  }
+  void write_bytes(const void *data, std::size_t length);
+  void write_bytes(std::string_view bytes) {
+    write_bytes(bytes.data(), bytes.size());
+  }
+  // as pfor.h, for values up to 64 bits
+  void write_vint(uint64_t value);
+  // little endian, 8 bytes
+  void write_u64(uint64_t value);
+  uint64_t get_file_pointer() const { return flushed + buffered; }
+  // CRC-32C of everything written so far
+  uint32_t get_checksum() const;
+  void write_footer();
+  // flushes the buffer and closes the file; it is durable once synced
+  virtual void close();
+};
+
+/*
+ * IndexInput reads a file through a buffer of IndexOutput::BufferSize
+ * bytes, from any position. Reading past the end throws.
+ */
+class IndexInput {
+  std::string name;
+  uint64_t file_length;
+  uint8_t *buffer;
+  uint64_t buffer_start; // file offset of buffer[0]
+  std::size_t buffered;
+  std::size_t position; // in the buffer
+  void refill();
+
+protected:
+  // reads length bytes at offset of the file, all of them within it
+  virtual void read_at(uint64_t offset, uint8_t *data,
+                       std::size_t length) = 0;
+
+public:
+  IndexInput(const std::string &name, uint64_t file_length);
+  IndexInput(const IndexInput &) = delete;
+  IndexInput &operator=(const IndexInput &) = delete;
+  virtual ~IndexInput();
+  const std::string &get_name() const { return name; }
+  uint64_t length() const { return file_length; }
+  uint64_t get_file_pointer() const { return buffer_start + position; }
+  void seek(uint64_t offset);
+  uint8_t read_byte() {
+    if (position == buffered) {
+      refill();
+    }
+    return buffer[position++];
+  }
+  void read_bytes(void *data, std::size_t length);
+  uint64_t read_vint();
+  uint64_t read_u64();
+  // reads the whole file and throws unless it ends with a matching footer;
+  // the position is then the start of the footer
+  void check_footer();
+};
+
+/*
+ * IndexOutput and IndexInput on a file descriptor, with pwrite and pread.
+ */
+class FileIndexOutput : public IndexOutput {
+  int fd;
+
+protected:
+  void write_at(uint64_t offset, const uint8_t *data,
+                std::size_t length) override;
+
+public:
+  // creates path, or truncates it
+  FileIndexOutput(const std::string &path, const std::string &name);
+  ~FileIndexOutput() override;
+  void close() override;
+};
+
+class FileIndexInput : public IndexInput {
+  int fd;
+  FileIndexInput(int fd, const std::string &path, const std::string &name);
+
+protected:
+  void read_at(uint64_t offset, uint8_t *data, std::size_t length) override;
+
+public:
+  FileIndexInput(const std::string &path, const std::string &name);
+  ~FileIndexInput() override;
+};
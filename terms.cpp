@@ -0,0 +1,281 @@
+#include "terms.h"
+#include "pfor.h"
+#include <algorithm>
+#include <stdexcept>
+
+static std::size_t shared_prefix(std::string_view a, std::string_view b) {
+  std::size_t length = std::min(a.size(), b.size());
+  std::size_t i = 0;
+  while (i < length && a[i] == b[i]) {
+    ++i;
+  }
+  return i;
+}
+
+static uint64_t load_u64(const uint8_t *p) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value |= (uint64_t)p[i] << (8 * i);
+  }
+  return value;
+}
+
+// TermsWriter
+
+/*
+ * TermsWriter constructor
+ */
+TermsWriter::TermsWriter(IndexOutput *terms, IndexOutput *index)
+    : terms(terms), index(index), block_terms(0), last_block_offset(0),
+      term_count(0), block_count(0) {
+  terms->write_bytes(TermsMagic, 4);
+  terms->write_vint(Version);
+  index->write_bytes(IndexMagic, 4);
+  index->write_vint(Version);
+}
+/*
+ * TermsWriter destructor
+ */
+TermsWriter::~TermsWriter() = default;
+
+void TermsWriter::add(std::string_view term, const TermInfo &info) {
+  if (block_terms == TermsPerBlock) {
+    flush_block();
+  }
+  std::size_t prefix = 0;
+  if (block_terms == 0) {
+    // the leader is stored whole, with absolute offsets
+    block_leader = term;
+    last_info = TermInfo();
+  } else {
+    prefix = shared_prefix(last_term, term);
+  }
+  write_vint(block, prefix);
+  write_vint(block, term.size() - prefix);
+  block.append(term.substr(prefix));
+  write_vint(block, info.doc_freq);
+  write_vint(block, info.total_term_freq);
+  write_vint(block, info.doc_offset - last_info.doc_offset);
+  write_vint(block, info.pos_offset - last_info.pos_offset);
+  last_term = term;
+  last_info = info;
+  ++block_terms;
+  ++term_count;
+}
+
+void TermsWriter::flush_block() {
+  if (block_terms == 0) {
+    return;
+  }
+  uint64_t offset = terms->get_file_pointer();
+  terms->write_vint(block_terms);
+  terms->write_bytes(block);
+  block.clear();
+  std::size_t prefix = shared_prefix(last_leader, block_leader);
+  index->write_vint(prefix);
+  index->write_vint(block_leader.size() - prefix);
+  index->write_bytes(std::string_view(block_leader).substr(prefix));
+  index->write_vint(offset - last_block_offset);
+  last_leader = block_leader;
+  last_block_offset = offset;
+  ++block_count;
+  block_terms = 0;
+}
+
+void TermsWriter::finish() {
+  flush_block();
+  index->write_u64(term_count);
+  index->write_u64(block_count);
+}
+
+// TermsEnum
+
+/*
+ * TermsEnum constructor, an exhausted enum until a seek positions it
+ */
+TermsEnum::TermsEnum(const TermsReader *reader)
+    : reader(reader), block(0), pos(nullptr), block_remaining(0),
+      has_upper(false), upper_inclusive(false), prefix_only(false),
+      pending(false), done(true) {}
+
+void TermsEnum::load_block(std::size_t block) {
+  this->block = block;
+  pos = reader->terms + reader->block_offsets[block];
+  block_remaining = read_vint(pos);
+  info = TermInfo();
+}
+
+bool TermsEnum::read_term() {
+  if (block_remaining == 0) {
+    if (block + 1 >= reader->block_count()) {
+      return false;
+    }
+    load_block(block + 1);
+  }
+  std::size_t prefix = read_vint(pos);
+  std::size_t suffix = read_vint(pos);
+  current.resize(prefix);
+  current.append(reinterpret_cast<const char *>(pos), suffix);
+  pos += suffix;
+  info.doc_freq = read_vint(pos);
+  info.total_term_freq = read_vint(pos);
+  info.doc_offset += read_vint(pos);
+  info.pos_offset += read_vint(pos);
+  --block_remaining;
+  return true;
+}
+
+bool TermsEnum::in_bounds() const {
+  if (!has_upper) {
+    return true;
+  }
+  if (prefix_only) {
+    return std::string_view(current).starts_with(upper);
+  }
+  int order = current.compare(upper);
+  return upper_inclusive ? order <= 0 : order < 0;
+}
+
+bool TermsEnum::next() {
+  if (done) {
+    return false;
+  }
+  if (pending) {
+    pending = false;
+  } else if (!read_term()) {
+    done = true;
+    return false;
+  }
+  if (!in_bounds()) {
+    done = true;
+    return false;
+  }
+  return true;
+}
+
+// TermsReader
+
+/*
+ * TermsReader constructor, loads the block leaders of index_file
+ */
+TermsReader::TermsReader(std::string_view terms_file,
+                         std::string_view index_file)
+    : terms(reinterpret_cast<const uint8_t *>(terms_file.data())),
+      terms_size(terms_file.size()) {
+  const uint8_t *in = reinterpret_cast<const uint8_t *>(index_file.data());
+  if (!terms_file.starts_with(TermsWriter::TermsMagic) ||
+      !index_file.starts_with(TermsWriter::IndexMagic) ||
+      index_file.size() < 4 + TermsWriter::IndexTrailerLength) {
+    throw std::runtime_error("Not a term dictionary");
+  }
+  in += 4;
+  const uint8_t *terms_in = terms + 4;
+  if (read_vint(in) != TermsWriter::Version ||
+      read_vint(terms_in) != TermsWriter::Version) {
+    throw std::runtime_error("Unsupported term dictionary version");
+  }
+  const uint8_t *trailer = reinterpret_cast<const uint8_t *>(
+      index_file.data() + index_file.size() - TermsWriter::IndexTrailerLength);
+  term_count = load_u64(trailer);
+  std::size_t blocks = load_u64(trailer + 8);
+  leader_starts.reserve(blocks + 1);
+  block_offsets.reserve(blocks + 1);
+  std::size_t last_leader_size = 0;
+  uint64_t offset = 0;
+  for (std::size_t i = 0; i < blocks; ++i) {
+    std::size_t prefix = read_vint(in);
+    std::size_t suffix = read_vint(in);
+    uint32_t start = leaders.size();
+    // the previous leader is at the end of leaders
+    leaders.append(leaders, leaders.size() - last_leader_size, prefix);
+    leaders.append(reinterpret_cast<const char *>(in), suffix);
+    in += suffix;
+    leader_starts.push_back(start);
+    last_leader_size = prefix + suffix;
+    offset += read_vint(in);
+    block_offsets.push_back(offset);
+  }
+  leader_starts.push_back(leaders.size());
+  block_offsets.push_back(terms_size);
+}
+/*
+ * TermsReader destructor
+ */
+TermsReader::~TermsReader() = default;
+
+std::string_view TermsReader::leader(std::size_t block) const {
+  return std::string_view(leaders).substr(
+      leader_starts[block], leader_starts[block + 1] - leader_starts[block]);
+}
+
+std::size_t TermsReader::find_block(std::string_view term) const {
+  std::size_t low = 0;
+  std::size_t high = block_count();
+  // first block whose leader is > term
+  while (low < high) {
+    std::size_t middle = (low + high) / 2;
+    if (leader(middle) <= term) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low > 0 ? low - 1 : 0;
+}
+
+/*
+ * An enum whose next() returns the first term >= lower (> lower if not
+ * inclusive).
+ */
+TermsEnum TermsReader::seek(std::string_view lower,
+                            bool lower_inclusive) const {
+  TermsEnum terms_enum(this);
+  if (block_count() == 0) {
+    return terms_enum;
+  }
+  terms_enum.load_block(find_block(lower));
+  while (terms_enum.read_term()) {
+    int order = terms_enum.current.compare(lower);
+    if (order > 0 || (order == 0 && lower_inclusive)) {
+      terms_enum.pending = true;
+      terms_enum.done = false;
+      break;
+    }
+  }
+  return terms_enum;
+}
+
+bool TermsReader::seek_exact(std::string_view term, TermInfo &info) const {
+  TermsEnum terms_enum = seek(term, true);
+  if (!terms_enum.next() || terms_enum.term() != term) {
+    return false;
+  }
+  info = terms_enum.term_info();
+  return true;
+}
+
+TermsEnum TermsReader::all() const { return seek("", true); }
+
+TermsEnum TermsReader::prefix(std::string_view prefix) const {
+  TermsEnum terms_enum = seek(prefix, true);
+  terms_enum.upper = prefix;
+  terms_enum.has_upper = true;
+  terms_enum.prefix_only = true;
+  return terms_enum;
+}
+
+TermsEnum TermsReader::range(std::string_view lower, bool lower_inclusive,
+                             std::string_view upper,
+                             bool upper_inclusive) const {
+  TermsEnum terms_enum = seek(lower, lower_inclusive);
+  terms_enum.upper = upper;
+  terms_enum.has_upper = true;
+  terms_enum.upper_inclusive = upper_inclusive;
+  return terms_enum;
+}
+
+std::size_t TermsReader::memory_usage() const {
+  return sizeof(*this) + leaders.capacity() +
+         leader_starts.capacity() * sizeof(uint32_t) +
+         block_offsets.capacity() * sizeof(uint64_t);
+}
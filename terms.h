@@ -0,0 +1,142 @@
+// sorted block term dictionary with an in-memory index of block leaders
+#pragma once
+
+#include "store.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * What the term dictionary knows about a term: its statistics and where
+ * its postings start in the .doc and .pos files.
+ */
+struct TermInfo {
+  uint64_t doc_freq = 0;
+  uint64_t total_term_freq = 0;
+  uint64_t doc_offset = 0;
+  uint64_t pos_offset = 0;
+};
+
+/*
+ * TermsWriter writes the two files of a field's term dictionary from terms
+ * added in sorted order (by bytes), a block at a time. Numbers are VInts.
+ *
+ * .tim, the terms, in blocks of up to TermsPerBlock:
+ *   "TLTM" version
+ *   per block: term_count, then per term:
+ *     prefix suffix_length suffix doc_freq total_term_freq
+ *     doc_offset_delta pos_offset_delta
+ *   Terms are front coded against the previous term of the same block, the
+ *   first term of a block (its leader) is stored whole. Offsets are deltas
+ *   from the previous term of the block, absolute for the leader. A block
+ *   can thus be decoded on its own.
+ *
+ * .tip, the terms index:
+ *   "TLTI" version
+ *   per block: prefix suffix_length suffix block_offset_delta
+ *   term_count block_count, as 8 little endian bytes each
+ *   The leader of every block, front coded against the previous leader,
+ *   and the block's offset in .tim as a delta from the previous block's.
+ *   The counts are only known at the end, so they come last.
+ *
+ * Both files then end with a footer, written by the caller; the readers
+ * take the bytes before it.
+ */
+class TermsWriter {
+  IndexOutput *terms; // .tim, not owned
+  IndexOutput *index; // .tip, not owned
+  std::string block;  // terms of the block being built
+  std::size_t block_terms;
+  std::string last_term;
+  TermInfo last_info;
+  std::string block_leader; // first term of the block being built
+  std::string last_leader;  // of the previous block
+  uint64_t last_block_offset;
+  uint64_t term_count;
+  uint64_t block_count;
+  void flush_block();
+
+public:
+  static constexpr std::size_t TermsPerBlock = 32;
+  static constexpr const char *TermsMagic = "TLTM";
+  static constexpr const char *IndexMagic = "TLTI";
+  static constexpr uint64_t Version = 2;
+  static constexpr std::size_t IndexTrailerLength = 16;
+
+  TermsWriter(IndexOutput *terms, IndexOutput *index);
+  ~TermsWriter();
+  void add(std::string_view term, const TermInfo &info);
+  // ends the last block and writes the counts
+  void finish();
+};
+
+class TermsReader;
+
+/*
+ * Enumerates terms in sorted order, from a start term up to a bound.
+ * Terms are decoded block by block straight from the .tim bytes.
+ */
+class TermsEnum {
+  friend class TermsReader;
+  const TermsReader *reader;
+  std::size_t block;           // block being decoded
+  const uint8_t *pos;          // next term in it
+  std::size_t block_remaining; // terms left in it
+  std::string current;
+  TermInfo info;
+  // bound
+  std::string upper;
+  bool has_upper;
+  bool upper_inclusive;
+  bool prefix_only; // stop once terms no longer start with upper
+  bool pending;     // current was read by a seek and not returned yet
+  bool done;
+  void load_block(std::size_t block);
+  bool read_term();
+  bool in_bounds() const;
+
+public:
+  TermsEnum(const TermsReader *reader);
+  // moves to the next term, false at the end
+  bool next();
+  std::string_view term() const { return current; }
+  const TermInfo &term_info() const { return info; }
+};
+
+/*
+ * TermsReader answers exact, prefix and range lookups on a field's term
+ * dictionary. Only the leader of each block is kept in memory; a lookup
+ * binary searches the leaders and then decodes a single block of .tim, so
+ * it touches one or two pages of the file. Both files are passed without
+ * their footer. The .tim bytes are not copied and must outlive the reader,
+ * e.g. a mapping of the file.
+ */
+class TermsReader {
+  friend class TermsEnum;
+  const uint8_t *terms;     // .tim
+  std::size_t terms_size;
+  uint64_t term_count;
+  std::string leaders;                 // all leaders, back to back
+  std::vector<uint32_t> leader_starts; // per block, plus the end
+  std::vector<uint64_t> block_offsets; // per block, plus the end of .tim
+  std::string_view leader(std::size_t block) const;
+  // last block whose leader is <= term, or 0
+  std::size_t find_block(std::string_view term) const;
+  TermsEnum seek(std::string_view lower, bool lower_inclusive) const;
+
+public:
+  TermsReader(std::string_view terms_file, std::string_view index_file);
+  ~TermsReader();
+  bool seek_exact(std::string_view term, TermInfo &info) const;
+  TermsEnum all() const;
+  TermsEnum prefix(std::string_view prefix) const;
+  // terms between lower and upper
+  TermsEnum range(std::string_view lower, bool lower_inclusive,
+                  std::string_view upper, bool upper_inclusive) const;
+  uint64_t size() const { return term_count; }
+  std::size_t block_count() const { return block_offsets.size() - 1; }
+  // bytes held in memory
+  std::size_t memory_usage() const;
+};
@@ -0,0 +1,73 @@
+// skip data check: a far advance() reads O(log n) skip entries
+#include "codec.h"
+#include "index.h"
+#include "reader.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Docs holding the term: 600 blocks, so four skip levels.
+const docid_t Docs = 600 * PostingsBlockSize;
+
+/*
+ * Entries a lookup may read: per level, the entries it walks and the one
+ * loaded after repositioning.
+ */
+static uint64_t max_entries(uint64_t doc_freq) {
+  uint64_t levels = 0;
+  for (uint64_t blocks = doc_freq / PostingsBlockSize; blocks > 0;
+       blocks /= SkipReader::SkipMultiplier) {
+    levels++;
+  }
+  return levels * (SkipReader::SkipMultiplier + 1);
+}
+
+int main() {
+  RAMDirectory directory;
+  BinaryCodec codec;
+  IndexWriterConfig config(&codec);
+  {
+    IndexWriter index_writer(&config, &directory);
+    const char content[] = "<html><body>word</body></html>";
+    for (docid_t i = 0; i < Docs; ++i) {
+      HtmlParser parser(content, sizeof(content) - 1);
+      Document document(&parser, content, sizeof(content) - 1);
+      index_writer.add_document(document);
+    }
+    index_writer.flush();
+    index_writer.commit();
+  }
+  IndexReader reader(&directory, &codec);
+  int failures = 0;
+  uint64_t limit = max_entries(Docs);
+  // every target from a fresh iterator, then a run of far jumps on one
+  std::vector<docid_t> targets = {8197, 16645, 40000, Docs - 1};
+  for (docid_t target : targets) {
+    auto postings = reader.postings("body", "word");
+    docid_t docid = postings[0].advance(target);
+    uint64_t read = postings[0].get_skip_entries_read();
+    std::printf("advance(%u) -> %u: %llu entries\n", (unsigned)target,
+                (unsigned)docid, (unsigned long long)read);
+    if (docid != target || read > limit) {
+      std::printf("  FAILED, expected doc %u and at most %llu entries\n",
+                  (unsigned)target, (unsigned long long)limit);
+      failures++;
+    }
+  }
+  auto postings = reader.postings("body", "word");
+  uint64_t before = 0;
+  for (docid_t target = 5000; target < Docs; target += 9000) {
+    docid_t docid = postings[0].advance(target);
+    uint64_t read = postings[0].get_skip_entries_read() - before;
+    before += read;
+    if (docid != target || read > limit) {
+      std::printf("advance(%u) -> %u after a skip: %llu entries, FAILED\n",
+                  (unsigned)target, (unsigned)docid,
+                  (unsigned long long)read);
+      failures++;
+    }
+  }
+  std::printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}